@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include "Interpolation.h"
+
+// IMA-ADPCM によるサンプルの圧縮形式 (16bit PCM の約1/4)
+// 波形を [0, loopStart) [loopStart, loopEnd) [loopEnd, length) の3区間に分け、
+// それぞれを先頭から ADPCM_BLOCK_SAMPLES ずつのブロックにする(区間の最後のブロックは短い)
+// 各ブロックは先頭に予測値と量子化幅を持つので、ループ開始位置からもそのまま展開できる
+//   int16_t predictor  ブロックの1サンプル前の値
+//   uint8_t stepIndex
+//   uint8_t reserved
+//   uint8_t nibbles[ADPCM_BLOCK_SAMPLES / 2]  下位4bitが先
+#define ADPCM_BLOCK_SAMPLES 128
+#define ADPCM_BLOCK_BYTES (4 + ADPCM_BLOCK_SAMPLES / 2)
+
+struct Sample;
+
+// position を含むブロックの番号と範囲 [start, end)
+struct AdpcmBlock
+{
+  uint32_t index;
+  uint32_t start;
+  uint32_t end;
+};
+
+AdpcmBlock FindAdpcmBlock(const Sample *sample, uint32_t position);
+// ループ開始位置の前のタップを展開しておく Sampleの作成・変更時に呼ぶ
+void InitSampleAdpcm(Sample *sample);
+// 圧縮データ全体のバイト数
+uint64_t AdpcmSize(uint32_t length, uint32_t loopStart, uint32_t loopEnd);
+// ブロックの先頭から count サンプルを展開する
+void DecodeAdpcm(const uint8_t *block, int16_t *out, uint32_t count);
+// [start, start + count) を展開する 波形の範囲外は0
+void DecodeAdpcmRange(const Sample *sample, int64_t start, uint32_t count, int16_t *out);
+
+// ボイスごとの展開済みブロック 前後には補間のタップ分も展開しておく
+// data[0] が波形の start - INTERPOLATION_TAPS_BEFORE サンプル目に当たる
+struct AdpcmWindow
+{
+  uint32_t start = 0;
+  uint32_t end = 0; // end == start なら空
+  int16_t data[INTERPOLATION_TAPS_BEFORE + ADPCM_BLOCK_SAMPLES + INTERPOLATION_TAPS_AFTER];
+
+  // position を含むブロックを展開する 続きのブロックなら前のブロックの末尾を引き継ぐ
+  void Load(const Sample *sample, uint32_t position);
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Sampler.h"
+
+#define ZONE_NONE 0xFF
+#define ZONE_VELOCITY_LAYERS 16 // ベロシティによって選ぶゾーンが変わる区間の最大数
+
+// 1つのSampleを割り当てる鍵域とベロシティの範囲
+struct SampleZone
+{
+  Sample *sample;
+  uint8_t noteLow;
+  uint8_t noteHigh;
+  uint8_t velocityLow;
+  uint8_t velocityHigh;
+};
+
+// 複数のゾーンからなる楽器
+// ノートオン時にゾーンを探さないよう、ノート番号×ベロシティからゾーンを引く表を InitInstrument で作っておく
+// ベロシティは、どの鍵でも同じゾーンを選ぶ連続した範囲ごとに1列にまとめる
+struct Instrument
+{
+  const SampleZone *zones;
+  uint8_t zoneCount;
+
+  uint8_t velocityLayers[128]; // ベロシティ → zoneTable の列
+  uint8_t zoneTable[128][ZONE_VELOCITY_LAYERS];
+};
+
+// zoneTable を作り、各ゾーンのSampleのADSR係数を計算する
+// ベロシティの区間が ZONE_VELOCITY_LAYERS を超える場合は false を返す
+bool InitInstrument(Instrument *instrument);
+
+inline Sample *FindSample(const Instrument *instrument, uint8_t noteNo, uint8_t velocity)
+{
+  uint8_t zone = instrument->zoneTable[noteNo & 0x7F][instrument->velocityLayers[velocity & 0x7F]];
+  return zone != ZONE_NONE ? instrument->zones[zone].sample : nullptr;
+}
+
+extern Instrument pianoInstrument;
+
+// ノートオンで使う楽器を、全チャンネルまたは channel だけ切り替える 初期値は pianoInstrument
+// オーディオタスクを起動する前に呼ぶ
+void SetInstrument(Instrument *instrument);
+void SetInstrument(uint8_t channel, Instrument *instrument);
+// プログラムチェンジで選ぶ楽器を登録する 登録の無い番号へのプログラムチェンジは無視する
+void SetProgram(uint8_t program, Instrument *instrument);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+
+// 波形読み出し時の補間方法
+enum SampleInterpolation
+{
+  InterpolationNone,    // 0次ホールド
+  InterpolationLinear,  // 線形補間
+  InterpolationHermite, // 4点エルミート補間
+  InterpolationSinc,    // 8タップの窓付きsinc
+};
+
+// 補間で参照する、再生位置より前・後ろのサンプル数
+#define INTERPOLATION_TAPS_BEFORE 3
+#define INTERPOLATION_TAPS_AFTER 4
+
+#define SINC_TAPS 8
+#define SINC_PHASES 64 // 小数部の分割数
+
+extern float sincTable[SINC_PHASES][SINC_TAPS];
+
+// sincTable を計算する 起動時に一度だけ呼ぶ
+void InitInterpolation();
+
+// p: 再生位置のサンプルへのポインタ frac: 再生位置の小数部(32bit)
+template <SampleInterpolation I>
+inline float Interpolate(const int16_t *p, uint32_t frac);
+
+template <>
+inline float Interpolate<InterpolationNone>(const int16_t *p, uint32_t frac)
+{
+  return p[0];
+}
+
+template <>
+inline float Interpolate<InterpolationLinear>(const int16_t *p, uint32_t frac)
+{
+  float t = frac * (1.0f / 4294967296.0f);
+  return p[0] + (p[1] - p[0]) * t;
+}
+
+template <>
+inline float Interpolate<InterpolationHermite>(const int16_t *p, uint32_t frac)
+{
+  float t = frac * (1.0f / 4294967296.0f);
+  float y0 = p[-1], y1 = p[0], y2 = p[1], y3 = p[2];
+  float c1 = 0.5f * (y2 - y0);
+  float c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+  float c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+  return ((c3 * t + c2) * t + c1) * t + y1;
+}
+
+template <>
+inline float Interpolate<InterpolationSinc>(const int16_t *p, uint32_t frac)
+{
+  const float *h = sincTable[frac >> (32 - 6)];
+  const int16_t *q = p - (SINC_TAPS / 2 - 1);
+  float val = 0.0f;
+  for (int k = 0; k < SINC_TAPS; k++) val += q[k] * h[k];
+  return val;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Sampler.h"
+
+#define LIMITER_LOOKAHEAD 32       // 先読みするサンプル数 (遅延は LIMITER_LOOKAHEAD - 1)
+#define LIMITER_CEILING 0.95f      // 出力の上限(int16フルスケール比)
+#define LIMITER_RELEASE_MS 50.0f   // ゲインが戻る時定数
+
+// 直近 LIMITER_LOOKAHEAD 個の値の最小値を求める単調増加キュー
+class SlidingMinimum
+{
+public:
+  // value を加え、value を含む直近 LIMITER_LOOKAHEAD 個の最小値を返す
+  float Push(float value);
+
+private:
+  float values[LIMITER_LOOKAHEAD];
+  uint32_t indices[LIMITER_LOOKAHEAD];
+  uint32_t head = 0, count = 0;
+  uint32_t index = 0;
+};
+
+// ミックスバス用の先読みピークリミッタ (LR連動)
+//   必要なゲイン → 先読み区間の最小値 → 同じ長さの移動平均 → 戻る方向だけ時定数で平滑化
+// 移動平均がピークの到達までに必要なゲインまで下がりきるので、上限を超えない
+class Limiter
+{
+public:
+  Limiter();
+
+  bool enabled = true;
+
+  // data (SAMPLE_BUFFER_SIZE×OUTPUT_CHANNELS) を遅延させつつ、
+  // data×masterVolume が LIMITER_CEILING を超えないようゲインを掛ける
+  void Process(float *data);
+  // 直近のブロックでの最小ゲイン(表示用)
+  float GainReduction() const { return minGain; }
+
+private:
+  float delay[LIMITER_LOOKAHEAD - 1][OUTPUT_CHANNELS];
+  uint32_t delayIndex = 0;
+
+  SlidingMinimum window;
+
+  float boxValues[LIMITER_LOOKAHEAD];
+  float boxSum = LIMITER_LOOKAHEAD;
+  uint32_t boxIndex = 0;
+
+  float gain = 1.0f;
+  float releaseCoef;
+  float minGain = 1.0f;
+};
+
+extern Limiter limiter;
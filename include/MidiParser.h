@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MIDI_SYSEX_SIZE 128 // 受け取れるSysExの長さ(F0・F7を含む) 超えた分は捨てる
+
+// MIDI 1.0 のバイト列を1バイトずつ解析する
+//   ランニングステータス、メッセージの途中に割り込むリアルタイムメッセージ(F8〜FF)、
+//   SysEx(F0〜F7、またはF7以外のステータスで終わるもの)に対応する
+// データバイトの値(0を含む)ではなく、受け取った数でメッセージの区切りを判断する
+class MidiParser
+{
+public:
+  // チャンネルメッセージ・システムコモン・リアルタイムが揃うたびに呼ばれる
+  // message は最大3バイトで、size は実際の長さ
+  void (*onMessage)(const uint8_t *message, uint8_t size) = nullptr;
+  // SysExが終わるたびに呼ばれる data は F0 から始まり、途中で切れていなければ F7 で終わる
+  void (*onSysEx)(const uint8_t *data, size_t size) = nullptr;
+
+  void Parse(const uint8_t *data, size_t size);
+  void Parse(uint8_t byte);
+  void Reset();
+
+  // MIDI_SYSEX_SIZE を超えて切り詰めたSysExの数
+  uint32_t SysExOverflows() const { return sysExOverflows; }
+
+private:
+  void EndSysEx();
+
+  uint8_t message[3] = {0}; // message[0] が0ならステータス待ち
+  uint8_t dataCount = 0;
+  uint8_t dataLength = 0;
+  bool inSysEx = false;
+  uint8_t sysEx[MIDI_SYSEX_SIZE];
+  size_t sysExLength = 0;
+  uint32_t sysExOverflows = 0;
+};
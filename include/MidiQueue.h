@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#define MIDI_QUEUE_SIZE 256 // 2の累乗
+
+struct MidiEvent
+{
+  uint32_t time; // 処理するサンプル位置 起動時からの通しのサンプル番号 (CurrentFrame と同じ基準)
+  uint8_t message[3];
+};
+
+// loop()(Core1) からオーディオタスク(Core0) へMIDIイベントを渡すロックフリーのリングバッファ
+// 生産者・消費者がそれぞれ1つの場合のみ安全
+class MidiQueue
+{
+public:
+  bool Push(const MidiEvent &event)
+  {
+    uint32_t head = this->head.load(std::memory_order_relaxed);
+    if (head - tail.load(std::memory_order_acquire) >= MIDI_QUEUE_SIZE)
+    {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    events[head & (MIDI_QUEUE_SIZE - 1)] = event;
+    this->head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool Pop(MidiEvent &event)
+  {
+    uint32_t tail = this->tail.load(std::memory_order_relaxed);
+    if (tail == head.load(std::memory_order_acquire)) return false;
+    event = events[tail & (MIDI_QUEUE_SIZE - 1)];
+    this->tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // 先頭のイベントを取り出さずに参照する
+  const MidiEvent *Peek() const
+  {
+    uint32_t tail = this->tail.load(std::memory_order_relaxed);
+    if (tail == head.load(std::memory_order_acquire)) return nullptr;
+    return &events[tail & (MIDI_QUEUE_SIZE - 1)];
+  }
+
+  uint32_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+  MidiEvent events[MIDI_QUEUE_SIZE];
+  std::atomic<uint32_t> head{0};
+  std::atomic<uint32_t> tail{0};
+  std::atomic<uint32_t> dropped{0};
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Sampler.h"
+
+// int16 の範囲を超えた時の処理
+enum OutputClip
+{
+  ClipHard, // 範囲内に張り付かせる
+  ClipSoft, // SOFT_CLIP_KNEE を超えた部分を滑らかに圧縮してから張り付かせる
+};
+
+#define SOFT_CLIP_KNEE 0.7f // ソフトクリップを始める振幅(フルスケール比)
+
+extern enum OutputClip outputClip;
+extern bool outputDither; // 変換前に±1LSBの三角分布ディザを加える
+
+// int32 を int16 の範囲に飽和させる ESP32 では CLAMPS 命令を使う
+inline int16_t SaturateInt16(int32_t x)
+{
+#if defined(__XTENSA__)
+  int32_t y;
+  asm("clamps %0, %1, 15" : "=a"(y) : "a"(x));
+  return y;
+#else
+  return x < -32768 ? -32768 : (x > 32767 ? 32767 : x);
+#endif
+}
+
+// ミックス結果(SAMPLE_BUFFER_SIZE×OUTPUT_CHANNELS)を masterVolume を掛けて int16 に変換する
+void ConvertOutput(const float *data, int16_t *dataI);
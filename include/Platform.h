@@ -0,0 +1,34 @@
+#pragma once
+
+// 実機(Arduino)とホスト(native)の差分を吸収する
+
+#ifdef ARDUINO
+
+#include <Arduino.h>
+
+// プロファイリング用 CPUサイクルカウンタ
+inline uint32_t CycleCount() { return ESP.getCycleCount(); }
+inline uint32_t CyclesPerMicrosecond() { return getCpuFrequencyMhz(); }
+
+#else
+
+#include <stdint.h>
+#include <math.h>
+#include <chrono>
+
+inline unsigned long micros()
+{
+  static const auto origin = std::chrono::steady_clock::now();
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - origin).count();
+}
+
+// ホストではCPUサイクルの代わりにナノ秒を数える
+inline uint32_t CycleCount()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+inline uint32_t CyclesPerMicrosecond() { return 1000; }
+
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Platform.h"
+#include <atomic>
+
+// オーディオ処理の段階ごとの計測区分
+enum ProfileStage
+{
+  ProfileVoice,    // 1ボイス分の波形生成
+  ProfileAdsr,     // 1ボイス分のADSR更新
+  ProfileGhost,    // 停止させたボイスのフェードアウト(ブロック全体)
+  ProfileDecode,   // ADPCMの1ブロック分の展開 (ProfileVoice に含まれる)
+  ProfileReverb,   // Reverb_Process
+  ProfileLimiter,  // ミックスバスのリミッタ
+  ProfileOutput,   // float → int16 変換
+  ProfileI2sWrite, // i2s_write でブロックしていた時間
+  ProfileBlock,    // 1ブロックの処理全体(i2s_write を除く)
+  PROFILE_STAGE_COUNT
+};
+
+#define PROFILER_RING_SIZE 1024 // 2の累乗
+#define PROFILER_HISTOGRAM_BINS 124
+
+// 段階ごとのサイクル数を集計する
+// Record はオーディオタスク、Collect/Dump は loop() から呼ぶ(単一生産者・単一消費者)
+class Profiler
+{
+public:
+  struct Stats
+  {
+    uint32_t count;
+    uint64_t sum;
+    uint32_t min;
+    uint32_t max;
+    uint32_t latest;
+    uint32_t histogram[PROFILER_HISTOGRAM_BINS];
+  };
+
+  // オーディオタスク側 リングバッファが一杯なら捨てる
+  inline void Record(ProfileStage stage, uint32_t cycles)
+  {
+    uint32_t head = ringHead.load(std::memory_order_relaxed);
+    if (head - ringTail.load(std::memory_order_acquire) >= PROFILER_RING_SIZE)
+    {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    if (cycles > 0x0FFFFFFF) cycles = 0x0FFFFFFF;
+    ring[head & (PROFILER_RING_SIZE - 1)] = ((uint32_t)stage << 28) | cycles;
+    ringHead.store(head + 1, std::memory_order_release);
+  }
+
+  // リングバッファに溜まった計測値を統計に反映する
+  void Collect();
+  // 統計をテキストで出力し、リセットする
+  void Dump(void (*print)(const char *line));
+  void Reset();
+
+  const Stats &GetStats(ProfileStage stage) const { return stats[stage]; }
+  // ヒストグラムから百分位点(上限値)を求める
+  uint32_t Percentile(ProfileStage stage, float percent) const;
+
+private:
+  uint32_t ring[PROFILER_RING_SIZE];
+  std::atomic<uint32_t> ringHead{0};
+  std::atomic<uint32_t> ringTail{0};
+  std::atomic<uint32_t> dropped{0};
+  Stats stats[PROFILE_STAGE_COUNT];
+};
+
+extern Profiler profiler;
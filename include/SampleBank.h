@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Sampler.h"
+#include "Instrument.h"
+
+// サンプルバンクのバイナリ形式 (リトルエンディアン)
+//   BankHeader
+//   BankSample × sampleCount
+//   BankZone × zoneCount
+//   PCM (16bit モノラル、または Adpcm.h の形式) 各サンプルの先頭は BANK_ALIGN バイト境界に揃える
+// PCMはコピーせず、マップした領域を Sample::sample から直接参照する
+#define BANK_MAGIC "SBNK"
+#define BANK_VERSION 1
+#define BANK_ALIGN 4
+#define BANK_MAX_SAMPLES 32
+#define BANK_MAX_ZONES 64
+
+enum BankEncoding
+{
+  BankPcm16,
+  BankImaAdpcm,
+};
+
+struct BankHeader
+{
+  char magic[4];
+  uint16_t version;
+  uint16_t sampleCount;
+  uint16_t zoneCount;
+  uint16_t reserved;
+  uint32_t size; // ファイル全体のバイト数 実機ではこの大きさだけマップする
+};
+
+struct BankSample
+{
+  uint32_t offset; // ファイル先頭からのPCMの位置(バイト)
+  uint32_t length; // サンプル数
+  uint32_t loopStart;
+  uint32_t loopEnd;
+  uint8_t root;
+  uint8_t adsrEnabled;
+  uint8_t interpolation; // enum SampleInterpolation
+  uint8_t encoding;      // enum BankEncoding
+  float attack;
+  float decay;
+  float sustain;
+  float release;
+};
+
+struct BankZone
+{
+  uint8_t sample; // BankSample の番号
+  uint8_t noteLow;
+  uint8_t noteHigh;
+  uint8_t velocityLow;
+  uint8_t velocityHigh;
+  uint8_t reserved[3];
+};
+
+static_assert(sizeof(BankHeader) == 16, "BankHeader must be packed");
+static_assert(sizeof(BankSample) == 36, "BankSample must be packed");
+static_assert(sizeof(BankZone) == 8, "BankZone must be packed");
+
+// バンクから作った楽器 data はマップした領域を指し、バンクを使う間は解放しない
+struct SampleBank
+{
+  const uint8_t *data;
+  uint32_t size;
+  uint8_t sampleCount;
+  Sample samples[BANK_MAX_SAMPLES];
+  SampleZone zones[BANK_MAX_ZONES];
+  Instrument instrument;
+};
+
+// メモリ上のバンクを検証し、samples・zones・instrument を作る
+// ベロシティで切り替えるゾーンの区間が ZONE_VELOCITY_LAYERS を超えるバンクは読み込まない
+bool LoadSampleBank(SampleBank *bank, const void *data, uint32_t size);
+// 実機ではフラッシュのデータパーティション(name はラベル)を、ホストではファイル(name はパス)をマップして読み込む
+bool MapSampleBank(SampleBank *bank, const char *name);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Sampler.h"
+
+#define SAMPLE_CACHE_HEAD 8192    // RAMにコピーする発音開始部分のサンプル数
+#define SAMPLE_CACHE_ENTRIES 32   // キャッシュできるSampleの数
+#define SAMPLE_CACHE_REQUESTS 64  // 2の累乗
+#define SAMPLE_PIN_BYTES (64 * 1024) // Pin で内部RAMに置いてよいバイト数
+
+// 発音開始部分とループ区間を、実機ではPSRAM(無ければ内部RAM)にコピーしておくキャッシュ
+// フラッシュのキャッシュミスで読み出し時間がばらつかないようにする
+//   オーディオタスク: ノートオンで Touch を呼び、ヒット・ミスを数えて要求を積む
+//   loop(): Service で要求を処理し、容量を超えたら最も昔にノートオンされたSampleから追い出す
+// 追い出したメモリは、読んでいたブロックの処理が終わるまで解放しない
+class SampleCache
+{
+public:
+  uint32_t capacity = 0; // 使ってよいバイト数 0なら無効
+
+  // オーディオタスク側
+  void Touch(Sample *sample);
+
+  // loop() 側
+  void Service();
+  // 起動時に呼ぶ 区間を内部RAMにコピーし、追い出さずに使い続ける
+  // フラッシュのキャッシュを他のタスクと取り合わないので、サステイン中の読み出し時間が安定する
+  bool Pin(Sample *sample);
+  uint32_t Pinned() const { return pinned; }
+  uint32_t Used() const { return used; }
+  uint32_t Hits() const { return hits.load(std::memory_order_relaxed); }
+  uint32_t Misses() const { return misses.load(std::memory_order_relaxed); }
+
+private:
+  struct Entry
+  {
+    Sample *sample;
+    int16_t *memory;
+    uint32_t bytes;
+    uint32_t lastUse; // 最後にノートオンされた時の useCount
+    bool pinned;
+  };
+  struct Retired
+  {
+    int16_t *memory;
+    uint32_t bytes;
+    uint32_t frame; // 追い出した時の CurrentFrame()
+  };
+
+  Entry *Find(Sample *sample);
+  bool Load(Entry &entry, bool internal);
+  void Evict(Entry &entry);
+  void FreeRetired();
+
+  Sample *requests[SAMPLE_CACHE_REQUESTS];
+  std::atomic<uint32_t> requestHead{0};
+  std::atomic<uint32_t> requestTail{0};
+  std::atomic<uint32_t> hits{0};
+  std::atomic<uint32_t> misses{0};
+
+  Entry entries[SAMPLE_CACHE_ENTRIES] = {};
+  Retired retired[SAMPLE_CACHE_ENTRIES] = {};
+  uint8_t retiredCount = 0;
+  uint32_t used = 0;
+  uint32_t pinned = 0;
+  uint32_t useCount = 0;
+};
+
+// キャッシュする区間を決める Sampleの作成・変更時に呼ぶ
+void InitSampleCache(Sample *sample);
+
+extern SampleCache sampleCache;
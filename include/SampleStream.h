@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+#include "Sampler.h"
+
+#define STREAM_CHUNK 1024 // 1回に読み込むサンプル数 (約23ms)
+// 補間のタップが読めるよう、各チャンクの前後に余分に読み込むサンプル数
+#define STREAM_GUARD_BEFORE INTERPOLATION_TAPS_BEFORE
+#define STREAM_GUARD_AFTER INTERPOLATION_TAPS_AFTER
+
+// ストリーミング再生の読み込み元
+// ファイルの dataOffset バイト目から、波形全体(Sample::length サンプル)がint16リトルエンディアンで並んでいること
+// 実機ではSDカード等をVFSでマウントし、ホストでは普通のファイルをそのまま開く
+struct SampleStream
+{
+  FILE *file;
+  uint32_t dataOffset;
+};
+
+// 最初に開いた時に streamBuffers を確保する オーディオタスクを起動する前に呼ぶ
+bool OpenSampleStream(SampleStream *stream, const char *path, uint32_t dataOffset);
+
+// ストリーミングで読み込む範囲の先頭 チャンク0はここから始まる
+// 常駐部分の末尾のサンプルも、補間のタップが揃うようチャンク側で扱う
+inline uint32_t StreamStart(const Sample *sample)
+{
+  return sample->residentLength - INTERPOLATION_TAPS_AFTER;
+}
+
+// ボイスごとのダブルバッファ
+// 再生中のチャンクを一方で読みながら、もう一方に次のチャンクをバックグラウンドで読み込む
+// wanted/loaded は (世代 << 16) | チャンク番号 で、世代はノートオンごとに変わる
+class StreamBuffer
+{
+public:
+  // オーディオタスク側 ノートオン時に呼び、先頭の2チャンクを要求する
+  void Start(const Sample *sample);
+  // オーディオタスク側 チャンクが読み込み済みならその先頭(チャンク開始位置 - STREAM_GUARD_BEFORE)を返す
+  // 読み込み済みなら次のチャンクをもう一方のバッファに要求する
+  // 読み込まれていなければ nullptr を返し、このチャンクと次のチャンクを要求し直す
+  const int16_t *Acquire(uint32_t chunk);
+  // 読み込みタスク側 要求されているチャンクを読み込む
+  void Fill();
+
+private:
+  int16_t data[2][STREAM_GUARD_BEFORE + STREAM_CHUNK + STREAM_GUARD_AFTER];
+  std::atomic<uint32_t> wanted[2] = {{0xFFFFFFFF}, {0xFFFFFFFF}};
+  std::atomic<uint32_t> loaded[2] = {{0xFFFFFFFF}, {0xFFFFFFFF}};
+  std::atomic<const Sample *> sample{nullptr};
+  uint16_t generation = 0;
+};
+
+// ボイスごとの StreamBuffer (MAX_SOUND 個) ストリームを開くまでは確保せず nullptr
+extern StreamBuffer *streamBuffers;
+
+// 読み込みタスクから繰り返し呼ぶ
+void ServiceSampleStreams();
+// 読み込みが間に合わず無音にしたチャンクの数
+uint32_t StreamUnderruns();
+void CountStreamUnderrun();
@@ -0,0 +1,251 @@
+#pragma once
+
+#include "Platform.h"
+#include "Interpolation.h"
+#include "Adpcm.h"
+#include "MidiQueue.h"
+
+#define SAMPLE_BUFFER_SIZE 64
+#define SAMPLE_RATE 44100
+#define OUTPUT_CHANNELS 2 // ミックスバス・I2S出力はLRインターリーブのステレオ
+constexpr uint32_t AUDIO_LOOP_INTERVAL = (uint32_t)(SAMPLE_BUFFER_SIZE * 1000000 / SAMPLE_RATE);// micro seconds
+
+#ifndef MAX_SOUND
+#define MAX_SOUND 12 // 最大同時発音数
+#endif
+
+// ボイスの集合 bit i が players[i]
+// MAX_SOUND に合わせた数の32bitワードで持つ (12ボイスなら1ワードで、ループは展開される)
+#define VOICE_MASK_WORDS ((MAX_SOUND + 31) / 32)
+struct VoiceMask
+{
+  uint32_t words[VOICE_MASK_WORDS];
+
+  VoiceMask() : words{} {}
+  static VoiceMask All()
+  {
+    VoiceMask mask;
+    for (uint8_t w = 0; w < VOICE_MASK_WORDS; w++) mask.words[w] = 0xFFFFFFFF;
+    return mask;
+  }
+
+  void Add(uint8_t voice) { words[voice >> 5] |= 1u << (voice & 31); }
+  void Remove(uint8_t voice) { words[voice >> 5] &= ~(1u << (voice & 31)); }
+  bool Has(uint8_t voice) const { return (words[voice >> 5] >> (voice & 31)) & 1; }
+  bool Any() const
+  {
+    for (uint8_t w = 0; w < VOICE_MASK_WORDS; w++)
+      if (words[w] != 0) return true;
+    return false;
+  }
+  // 番号が最も小さいボイスを取り除いて返す Any() の時だけ呼ぶ
+  uint8_t PopLowest()
+  {
+    for (uint8_t w = 0; w < VOICE_MASK_WORDS; w++)
+    {
+      if (words[w] == 0) continue;
+      uint8_t voice = w * 32 + __builtin_ctz(words[w]);
+      words[w] &= words[w] - 1;
+      return voice;
+    }
+    return MAX_SOUND;
+  }
+
+  VoiceMask operator~() const
+  {
+    VoiceMask mask;
+    for (uint8_t w = 0; w < VOICE_MASK_WORDS; w++) mask.words[w] = ~words[w];
+    return mask;
+  }
+  VoiceMask &operator&=(const VoiceMask &other)
+  {
+    for (uint8_t w = 0; w < VOICE_MASK_WORDS; w++) words[w] &= other.words[w];
+    return *this;
+  }
+  VoiceMask &operator|=(const VoiceMask &other)
+  {
+    for (uint8_t w = 0; w < VOICE_MASK_WORDS; w++) words[w] |= other.words[w];
+    return *this;
+  }
+  VoiceMask operator&(const VoiceMask &other) const { return VoiceMask(*this) &= other; }
+  VoiceMask operator|(const VoiceMask &other) const { return VoiceMask(*this) |= other; }
+};
+
+#define GHOST_SOUND 4   // 停止させたボイスをフェードアウトさせるための予備の発音数
+#define GHOST_FADE_MS 2 // 停止させたボイスのフェードアウト時間
+
+#define PITCH_BEND_RANGE 2 // ピッチベンドの幅の初期値(半音) RPN 0 で変更できる
+#define RPN_NULL 0x3FFF    // RPNを選んでいない状態
+
+// ビブラート チャンネルごとのLFOをブロック単位で進める
+#define VIBRATO_RATE 5.5f           // Hz
+#define VIBRATO_DEPTH 0.5f          // モジュレーション(CC1) 127 での深さ(半音)
+#define PRESSURE_VIBRATO_DEPTH 0.5f // チャンネルアフタータッチ 127 で加える深さ(半音)
+
+#define MIDI_CHANNELS 16
+
+#define SOFT_PEDAL_GAIN 0.7f // ソフトペダル(CC67)を踏んでいる間に発音した音の音量
+
+// リリースベロシティ 0/127 でリリース時間を何倍・何分の1にするか (64で元の長さ)
+#define RELEASE_VELOCITY_RANGE 2.0f
+#define RELEASE_VELOCITY_SHIFT 3 // リリースの係数はベロシティを8刻みで引く
+#define RELEASE_VELOCITY_STEPS (128 >> RELEASE_VELOCITY_SHIFT)
+
+#define PHASE_ONE (1ULL << 32) // 再生位置の固定小数点における1サンプル
+
+extern float masterVolume;
+
+// RAMにコピーして読む区間 (SampleCache.h)
+struct SampleRegion
+{
+  uint32_t start;
+  uint32_t end; // end == start なら使わない
+  std::atomic<const int16_t *> data; // コピーがあればその先頭 data[0] が start サンプル目
+};
+
+#define SAMPLE_REGIONS 2 // 発音開始部分とループ区間
+
+enum SampleAdsr
+{
+  attack,
+  decay,
+  sustain,
+  release,
+};
+
+struct Sample
+{
+  const int16_t *sample;
+  uint32_t length;
+  uint8_t root;
+  uint32_t loopStart;
+  uint32_t loopEnd;
+
+  bool adsrEnabled;
+  float attack;  // 0から1に達するまでの時間(ms)
+  float decay;   // sustainに向かって減衰する時定数(ms)
+  float sustain; // 0〜1
+  float release; // 0に向かって減衰する時定数(ms)
+
+  enum SampleInterpolation interpolation;
+
+  // InitSampleAdsr で計算する1ブロックあたりの係数
+  float attackStep;
+  float decayCoef;
+  float releaseCoefs[RELEASE_VELOCITY_STEPS]; // リリースベロシティごと
+
+  // ストリーミング再生する場合の読み込み元 nullptrなら sample に波形全体が載っている
+  // ストリーミング時は sample には先頭 residentLength サンプルだけを載せ、残りは読み込みタスクが読み込む
+  // ループ区間は常駐部分に収めること (loopEnd <= residentLength - INTERPOLATION_TAPS_AFTER)
+  struct SampleStream *stream;
+  uint32_t residentLength;
+
+  // IMA-ADPCMで圧縮した波形(形式は Adpcm.h) nullptrでなければ sample の代わりに使う
+  // 圧縮した波形はストリーミングしない
+  const uint8_t *adpcm;
+  int16_t loopPreroll[INTERPOLATION_TAPS_BEFORE]; // InitSampleAdpcm で展開する、ループ開始位置の前のサンプル
+
+  struct SampleRegion regions[SAMPLE_REGIONS]; // InitSampleCache で決める
+};
+
+class StreamBuffer;
+
+struct SamplePlayer
+{
+  SamplePlayer(struct Sample *sample, uint8_t noteNo, float volume)
+    : sample{sample}, noteNo{noteNo}, volume{volume} {}
+  SamplePlayer() : sample{nullptr}, noteNo{60}, volume{1.0f}, playing{false} {}
+  struct Sample *sample;
+  uint8_t noteNo;
+  uint8_t channel = 0;
+  float pitch = 1.0f; // ブロック終端での再生速度 ブロックごと・ピッチベンド時に PitchFromNoteNo で求める
+  uint64_t phaseIncrement = PHASE_ONE; // 再生速度を32.32固定小数点にしたもの
+  int64_t phaseIncrementStep = 0;      // 波形生成中に phaseIncrement を1サンプルごとに変化させる量
+  float volume; // ベロシティによる音量 チャンネルの音量は UpdateEnvelope で掛ける
+  uint64_t phase = 0; // 再生位置 32.32固定小数点 (上位32bitがサンプル番号)
+  bool playing = true;
+  bool released = false;
+  float adsrGain = 0.0f;
+  float releaseCoef = 0.0f; // ノートオフ時にリリースベロシティから決める
+  float gain = 0.0f;     // volume×ADSR 波形生成中に gainStep ずつ変化する
+  float gainStep = 0.0f;
+  float panLeft = 0.70710678f; // 定パワーパンのゲイン SetPan で求める
+  float panRight = 0.70710678f;
+  enum SampleAdsr adsrState = SampleAdsr::attack;
+  StreamBuffer *stream = nullptr; // ストリーミング再生用のバッファ ゴーストはnullptrで、常駐部分だけを鳴らす
+  AdpcmWindow adpcm;              // 圧縮した波形を展開したブロック
+};
+
+// チャンネルごとの状態 HandleMidiMessage で更新する
+// ボイス数の上限・予約は voiceAllocator.channelLimit / channelReserve で設定する
+struct MidiChannel
+{
+  struct Instrument *instrument; // SetInstrument・プログラムチェンジで切り替える
+  float volume;    // CC7 を2乗カーブで0〜1にしたもの
+  int16_t bend;    // ピッチベンドの値 -8192〜8191
+  float bendRange; // ピッチベンドの幅(半音) RPN 0 で設定する
+  float pitchBend; // bend を半音にしたもの
+  uint8_t pan;     // CC10
+  uint16_t rpn;    // CC101/100 で選んだRPN データエントリ(CC6/38)の対象
+
+  // モジュレーション(CC1)とチャンネルアフタータッチの和でビブラートをかける
+  uint8_t modulation;
+  uint8_t pressure;
+  float lfoPhase; // 0〜1
+  float vibrato;  // このブロックのLFOによる音程の変化(半音)
+
+  // ペダル CC64/66/67
+  // ペダルを離した時は、保持していたボイスをビット演算で選んでまとめてリリースする
+  bool sustain;
+  bool sostenuto;
+  bool soft;
+  VoiceMask keyDown;         // 鍵盤を押している間のボイス
+  VoiceMask pedalHeld;       // 離鍵したがペダルで鳴らし続けているボイス
+  VoiceMask sostenutoVoices; // ソステヌートを踏んだ時に押していたボイス
+};
+
+extern struct Sample piano;
+extern SamplePlayer players[MAX_SOUND];
+extern MidiChannel channels[MIDI_CHANNELS];
+
+// 起動時に一度だけ呼ぶ
+void InitSampler();
+// ADSRの時間をブロック単位の係数に変換する Sampleの作成・変更時に呼ぶ
+void InitSampleAdsr(Sample *sample);
+
+// ルートからの音程差(半音+ピッチベンド)を再生速度に変換する
+float PitchFromNoteNo(uint8_t noteNo, uint8_t root, float pitchBend);
+// 再生速度を直ちに設定し、位相の増分を計算し直す 発音開始時に使う
+inline void SetPitch(SamplePlayer *player, float pitch)
+{
+  player->pitch = pitch;
+  player->phaseIncrement = (uint64_t)((double)pitch * PHASE_ONE);
+  player->phaseIncrementStep = 0;
+}
+
+// channnel: 0〜15
+void SendNoteOn(uint8_t noteNo, uint8_t velocity, uint8_t channnel);
+// velocity はリリースベロシティ 0はリリースベロシティ非対応の機器が送るので64として扱う
+void SendNoteOff(uint8_t noteNo, uint8_t velocity, uint8_t channnel);
+// value: -8192 〜 8191
+void SendPitchBend(int16_t value, uint8_t channnel);
+void SendControlChange(uint8_t control, uint8_t value, uint8_t channnel);
+void SendProgramChange(uint8_t program, uint8_t channnel);
+// チャンネルアフタータッチ ビブラートを深くする
+void SendChannelPressure(uint8_t value, uint8_t channnel);
+// pan: 0(左) 〜 64(中央) 〜 127(右)
+void SetPan(SamplePlayer *player, uint8_t pan);
+void HandleMidiMessage(uint8_t *message);
+
+// 発音状態(players)はオーディオタスクだけが触るため、他のタスクからはキュー経由で送る
+// イベントの時刻はサンプル単位で、RenderBlock がブロック内の該当位置で処理する
+extern MidiQueue midiQueue;
+// loop() 側から呼ぶ 呼び出した時刻から1ブロック遅れた位置で処理される
+bool PostMidiMessage(uint8_t status, uint8_t data1, uint8_t data2);
+// 処理するサンプル位置を指定して送る(ホストでのオフライン描画用)
+bool PostMidiMessageAt(uint32_t frame, uint8_t status, uint8_t data1, uint8_t data2);
+// PostMidiMessage が使う、現在時刻に対応するサンプル位置
+uint32_t CurrentFrame();
+
+// キューのMIDIイベントを反映しながら、全Playerの波形を data (SAMPLE_BUFFER_SIZE×OUTPUT_CHANNELS) に加算する
+void RenderBlock(float *data);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Sampler.h"
+
+#define VOICE_NONE 0xFF
+
+// 全てのボイスが発音中の時に、どのボイスを止めるか
+enum VoiceStealPolicy
+{
+  StealOldest,        // 最も昔に発音したボイス
+  StealQuietest,      // 現在の音量(ベロシティ×チャンネルの音量×ADSR)が最も小さいボイス
+  StealReleasedFirst, // ノートオフ済みのうち最も昔に離鍵したボイス 無ければ最も昔のボイス
+  StealSameNote,      // 同じノート番号のボイスを鳴らし直す 無ければ最も昔のボイス
+};
+
+// players の割り当てを、空きボイスのスタックと2つの双方向リストで管理する
+//   発音中リスト: 全ての発音中ボイスを確保した順に並べたもの(先頭が最も古い)
+//   リリースリスト: ノートオフ済みのボイスを離鍵した順に並べたもの
+// 確保・解放・ノートオフはO(1)で、止めるボイスを選ぶ時だけリストを走査する
+//
+// ボイスはチャンネル間で共有し、チャンネルごとに次の制限を掛けられる
+//   channelLimit: そのチャンネルが同時に使えるボイス数 超えたら自分のボイスから止める
+//   channelReserve: そのチャンネルのために空けておくボイス数 他のチャンネルは、
+//                   予約に満たないチャンネルのボイスを止めたり、残りの予約分の空きを使ったりできない
+class VoiceAllocator
+{
+public:
+  VoiceAllocator();
+
+  VoiceStealPolicy policy = StealOldest;
+  uint8_t channelLimit[MIDI_CHANNELS];
+  uint8_t channelReserve[MIDI_CHANNELS];
+
+  // channel のボイスを確保する 空きが使えなければ policy に従って発音中のボイスを選び、*stolen を true にする
+  // 制限により確保できなければ VOICE_NONE を返す
+  uint8_t Allocate(uint8_t channel, uint8_t noteNo, bool *stolen);
+  // ノートオフされたボイスをリリースリストに加える
+  void Release(uint8_t voice);
+  // 発音を終えたボイスを空きスタックに戻す
+  void Free(uint8_t voice);
+
+  // 発音中のボイスを古い順に辿る
+  uint8_t First() const { return activeHead; }
+  uint8_t Next(uint8_t voice) const { return activeNext[voice]; }
+  bool IsActive(uint8_t voice) const { return state[voice] != VoiceFree; }
+  bool IsReleased(uint8_t voice) const { return state[voice] == VoiceReleased; }
+  // チャンネルの発音中のボイス
+  VoiceMask ChannelVoices(uint8_t channel) const { return channelVoices[channel]; }
+  uint8_t ChannelCount(uint8_t channel) const { return channelCount[channel]; }
+
+private:
+  enum VoiceState : uint8_t
+  {
+    VoiceFree,
+    VoiceHeld,
+    VoiceReleased,
+  };
+
+  VoiceState state[MAX_SOUND];
+  uint8_t activePrev[MAX_SOUND];
+  uint8_t activeNext[MAX_SOUND]; // 空きボイスではスタックの次
+  uint8_t releasedPrev[MAX_SOUND];
+  uint8_t releasedNext[MAX_SOUND];
+
+  uint8_t freeHead;
+  uint8_t activeHead = VOICE_NONE, activeTail = VOICE_NONE;
+  uint8_t releasedHead = VOICE_NONE, releasedTail = VOICE_NONE;
+  uint8_t noteVoice[MIDI_CHANNELS][128]; // ノート番号ごとに最後に確保したボイス
+  uint8_t voiceChannel[MAX_SOUND];
+  VoiceMask channelVoices[MIDI_CHANNELS];
+  uint8_t channelCount[MIDI_CHANNELS];
+  uint8_t activeCount = 0;
+
+  VoiceMask Stealable(uint8_t channel) const;
+  uint8_t SelectVictim(VoiceMask candidates) const;
+  void Unlink(uint8_t voice);
+  void UnlinkReleased(uint8_t voice);
+};
+
+extern VoiceAllocator voiceAllocator;
@@ -0,0 +1,119 @@
+#include "Adpcm.h"
+#include "Sampler.h"
+#include "Profiler.h"
+
+#include <string.h>
+
+namespace
+{
+  const int16_t stepTable[89] = {
+      7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+      50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+      337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+      2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+      15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+  const int8_t indexTable[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+  inline uint32_t BlockCount(uint32_t samples)
+  {
+    return (samples + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES;
+  }
+}
+
+AdpcmBlock FindAdpcmBlock(const Sample *sample, uint32_t position)
+{
+  // 区間の先頭・終端・その区間より前のブロック数
+  uint32_t segmentStart = 0, segmentEnd = sample->loopStart, blocksBefore = 0;
+  if (position >= sample->loopEnd)
+  {
+    segmentStart = sample->loopEnd;
+    segmentEnd = sample->length;
+    blocksBefore = BlockCount(sample->loopStart) + BlockCount(sample->loopEnd - sample->loopStart);
+  }
+  else if (position >= sample->loopStart)
+  {
+    segmentStart = sample->loopStart;
+    segmentEnd = sample->loopEnd;
+    blocksBefore = BlockCount(sample->loopStart);
+  }
+  uint32_t k = (position - segmentStart) / ADPCM_BLOCK_SAMPLES;
+  AdpcmBlock block;
+  block.index = blocksBefore + k;
+  block.start = segmentStart + k * ADPCM_BLOCK_SAMPLES;
+  block.end = segmentEnd - block.start > ADPCM_BLOCK_SAMPLES ? block.start + ADPCM_BLOCK_SAMPLES : segmentEnd;
+  return block;
+}
+
+uint64_t AdpcmSize(uint32_t length, uint32_t loopStart, uint32_t loopEnd)
+{
+  return (uint64_t)(BlockCount(loopStart) + BlockCount(loopEnd - loopStart) + BlockCount(length - loopEnd)) * ADPCM_BLOCK_BYTES;
+}
+
+void DecodeAdpcm(const uint8_t *block, int16_t *out, uint32_t count)
+{
+  int32_t predictor = (int16_t)(block[0] | (block[1] << 8));
+  int32_t index = block[2];
+  const uint8_t *nibbles = block + 4;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint8_t code = (nibbles[i >> 1] >> ((i & 1) * 4)) & 0x0F;
+    int32_t step = stepTable[index];
+    int32_t diff = step >> 3;
+    if (code & 4) diff += step;
+    if (code & 2) diff += step >> 1;
+    if (code & 1) diff += step >> 2;
+    predictor += (code & 8) ? -diff : diff;
+    predictor = predictor < -32768 ? -32768 : (predictor > 32767 ? 32767 : predictor);
+    index += indexTable[code & 7];
+    index = index < 0 ? 0 : (index > 88 ? 88 : index);
+    out[i] = predictor;
+  }
+}
+
+void DecodeAdpcmRange(const Sample *sample, int64_t start, uint32_t count, int16_t *out)
+{
+  int64_t end = start + count;
+  while (start < end)
+  {
+    if (start < 0 || start >= sample->length)
+    {
+      *out++ = 0;
+      start++;
+      continue;
+    }
+    AdpcmBlock block = FindAdpcmBlock(sample, (uint32_t)start);
+    uint32_t n = (uint32_t)((end < block.end ? end : block.end) - block.start);
+    int16_t decoded[ADPCM_BLOCK_SAMPLES];
+    DecodeAdpcm(sample->adpcm + block.index * ADPCM_BLOCK_BYTES, decoded, n);
+    uint32_t skip = (uint32_t)(start - block.start);
+    memcpy(out, decoded + skip, (n - skip) * sizeof(int16_t));
+    out += n - skip;
+    start = block.start + n;
+  }
+}
+
+void InitSampleAdpcm(Sample *sample)
+{
+  if (sample->adpcm == nullptr) return;
+  DecodeAdpcmRange(sample, (int64_t)sample->loopStart - INTERPOLATION_TAPS_BEFORE, INTERPOLATION_TAPS_BEFORE, sample->loopPreroll);
+}
+
+void AdpcmWindow::Load(const Sample *sample, uint32_t position)
+{
+  uint32_t startCycles = CycleCount();
+  AdpcmBlock block = FindAdpcmBlock(sample, position);
+
+  // 前のタップ: 続きのブロックなら前のブロックの末尾を、ループ開始位置なら InitSampleAdpcm で展開しておいたものを使う
+  if (end != start && block.start == end)
+    memmove(data, data + (end - start), INTERPOLATION_TAPS_BEFORE * sizeof(int16_t));
+  else if (block.start == sample->loopStart && block.start != 0)
+    memcpy(data, sample->loopPreroll, sizeof(sample->loopPreroll));
+  else
+    DecodeAdpcmRange(sample, (int64_t)block.start - INTERPOLATION_TAPS_BEFORE, INTERPOLATION_TAPS_BEFORE, data);
+
+  DecodeAdpcm(sample->adpcm + block.index * ADPCM_BLOCK_BYTES, data + INTERPOLATION_TAPS_BEFORE, block.end - block.start);
+  DecodeAdpcmRange(sample, block.end, INTERPOLATION_TAPS_AFTER, data + INTERPOLATION_TAPS_BEFORE + (block.end - block.start));
+  start = block.start;
+  end = block.end;
+  profiler.Record(ProfileDecode, CycleCount() - startCycles);
+}
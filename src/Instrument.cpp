@@ -0,0 +1,57 @@
+#include "Instrument.h"
+#include "SampleCache.h"
+
+namespace
+{
+  inline int Distance(int value, int low, int high)
+  {
+    if (value < low) return low - value;
+    if (value > high) return value - high;
+    return 0;
+  }
+}
+
+bool InitInstrument(Instrument *instrument)
+{
+  for (uint8_t i = 0; i < instrument->zoneCount; i++)
+  {
+    InitSampleAdsr(instrument->zones[i].sample);
+    InitSampleAdpcm(instrument->zones[i].sample);
+    InitSampleCache(instrument->zones[i].sample);
+  }
+
+  int layer = -1;
+  for (int velocity = 0; velocity < 128; velocity++)
+  {
+    // 全ての鍵について、このベロシティで使うゾーンを求める
+    // どのゾーンにも含まれない場合は、鍵域・ベロシティが最も近いゾーンを使う
+    uint8_t column[128];
+    for (int note = 0; note < 128; note++)
+    {
+      uint8_t best = ZONE_NONE;
+      int bestDistance = 0;
+      for (uint8_t z = 0; z < instrument->zoneCount; z++)
+      {
+        const SampleZone &zone = instrument->zones[z];
+        int distance = Distance(note, zone.noteLow, zone.noteHigh) * 128 + Distance(velocity, zone.velocityLow, zone.velocityHigh);
+        if (best == ZONE_NONE || distance < bestDistance)
+        {
+          best = z;
+          bestDistance = distance;
+        }
+      }
+      column[note] = best;
+    }
+
+    // 1つ前のベロシティと同じなら同じ列を使う
+    bool same = layer >= 0;
+    for (int note = 0; same && note < 128; note++) same = instrument->zoneTable[note][layer] == column[note];
+    if (!same)
+    {
+      if (++layer == ZONE_VELOCITY_LAYERS) return false;
+      for (int note = 0; note < 128; note++) instrument->zoneTable[note][layer] = column[note];
+    }
+    instrument->velocityLayers[velocity] = layer;
+  }
+  return true;
+}
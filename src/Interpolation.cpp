@@ -0,0 +1,29 @@
+#include "Interpolation.h"
+
+#include <math.h>
+
+float sincTable[SINC_PHASES][SINC_TAPS];
+
+void InitInterpolation()
+{
+  static_assert(SINC_PHASES == 64, "Interpolate<InterpolationSinc> assumes 6bit phase");
+  const double pi = 3.14159265358979323846;
+  for (int phase = 0; phase < SINC_PHASES; phase++)
+  {
+    double frac = (double)phase / SINC_PHASES;
+    double sum = 0.0;
+    double h[SINC_TAPS];
+    for (int k = 0; k < SINC_TAPS; k++)
+    {
+      // タップkは再生位置から (k - 3) の位置のサンプル
+      double x = (k - (SINC_TAPS / 2 - 1)) - frac;
+      double sinc = x == 0.0 ? 1.0 : sin(pi * x) / (pi * x);
+      // Blackman窓
+      double w = 0.42 + 0.5 * cos(pi * x / (SINC_TAPS / 2)) + 0.08 * cos(2.0 * pi * x / (SINC_TAPS / 2));
+      h[k] = sinc * w;
+      sum += h[k];
+    }
+    // 直流のゲインを1に揃える
+    for (int k = 0; k < SINC_TAPS; k++) sincTable[phase][k] = (float)(h[k] / sum);
+  }
+}
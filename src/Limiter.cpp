@@ -0,0 +1,85 @@
+#include "Limiter.h"
+#include "Profiler.h"
+
+#include <math.h>
+
+Limiter limiter;
+
+float SlidingMinimum::Push(float value)
+{
+  // 区間から外れる先頭を先に取り除く 残りは最大 LIMITER_LOOKAHEAD - 1 個なので追加しても溢れない
+  if (count > 0 && index - indices[head] >= LIMITER_LOOKAHEAD)
+  {
+    if (++head == LIMITER_LOOKAHEAD) head = 0;
+    count--;
+  }
+  while (count > 0 && values[(head + count - 1) % LIMITER_LOOKAHEAD] >= value) count--;
+  uint32_t tail = (head + count) % LIMITER_LOOKAHEAD;
+  values[tail] = value;
+  indices[tail] = index;
+  count++;
+  index++;
+  return values[head];
+}
+
+Limiter::Limiter()
+{
+  for (uint32_t i = 0; i < LIMITER_LOOKAHEAD - 1; i++)
+  {
+    for (uint8_t c = 0; c < OUTPUT_CHANNELS; c++) delay[i][c] = 0.0f;
+  }
+  for (uint32_t i = 0; i < LIMITER_LOOKAHEAD; i++) boxValues[i] = 1.0f;
+  releaseCoef = 1.0f - expf(-1000.0f / (LIMITER_RELEASE_MS * SAMPLE_RATE));
+}
+
+void Limiter::Process(float *data)
+{
+  if (!enabled) return;
+  uint32_t startCycles = CycleCount();
+
+  const float threshold = LIMITER_CEILING * 32767.0f / masterVolume;
+  float blockMinGain = 1.0f;
+  for (uint32_t n = 0; n < SAMPLE_BUFFER_SIZE; n++)
+  {
+    float *frame = &data[n * OUTPUT_CHANNELS];
+
+    // このサンプルに必要なゲイン
+    float peak = 0.0f;
+    for (uint8_t c = 0; c < OUTPUT_CHANNELS; c++)
+    {
+      float magnitude = fabsf(frame[c]);
+      if (magnitude > peak) peak = magnitude;
+    }
+    float required = peak > threshold ? threshold / peak : 1.0f;
+
+    // 直近 LIMITER_LOOKAHEAD サンプルの最小値
+    float held = window.Push(required);
+
+    // 移動平均で滑らかに下げる
+    boxSum += held - boxValues[boxIndex];
+    boxValues[boxIndex] = held;
+    if (++boxIndex == LIMITER_LOOKAHEAD) boxIndex = 0;
+    float target = boxSum * (1.0f / LIMITER_LOOKAHEAD);
+
+    // 下げる方向は即座に、戻る方向はゆっくり
+    if (target < gain) gain = target;
+    else gain += (target - gain) * releaseCoef;
+    if (gain < blockMinGain) blockMinGain = gain;
+
+    // LIMITER_LOOKAHEAD - 1 サンプル前の入力にゲインを掛けて出力する
+    float *delayed = delay[delayIndex];
+    for (uint8_t c = 0; c < OUTPUT_CHANNELS; c++)
+    {
+      float input = frame[c];
+      frame[c] = delayed[c] * gain;
+      delayed[c] = input;
+    }
+    if (++delayIndex == LIMITER_LOOKAHEAD - 1) delayIndex = 0;
+  }
+  // 移動平均の誤差が溜まらないよう合計を取り直す
+  boxSum = 0.0f;
+  for (uint32_t i = 0; i < LIMITER_LOOKAHEAD; i++) boxSum += boxValues[i];
+  minGain = blockMinGain;
+
+  profiler.Record(ProfileLimiter, CycleCount() - startCycles);
+}
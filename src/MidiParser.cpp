@@ -0,0 +1,118 @@
+#include "MidiParser.h"
+
+namespace
+{
+  // ステータスバイトに続くデータバイトの数
+  uint8_t DataLength(uint8_t status)
+  {
+    switch (status & 0xF0)
+    {
+    case 0xC0: // プログラムチェンジ
+    case 0xD0: // チャンネルプレッシャー
+      return 1;
+    case 0xF0:
+      switch (status)
+      {
+      case 0xF1: // MTCクォーターフレーム
+      case 0xF3: // ソングセレクト
+        return 1;
+      case 0xF2: // ソングポジション
+        return 2;
+      default:
+        return 0;
+      }
+    default:
+      return 2;
+    }
+  }
+}
+
+void MidiParser::Parse(const uint8_t *data, size_t size)
+{
+  for (size_t i = 0; i < size; i++) Parse(data[i]);
+}
+
+void MidiParser::Parse(uint8_t byte)
+{
+  // リアルタイムメッセージはどこに割り込んでも、解析中の状態を変えずにそのまま渡す
+  if (byte >= 0xF8)
+  {
+    if (onMessage != nullptr) onMessage(&byte, 1);
+    return;
+  }
+
+  if (byte & 0x80)
+  {
+    // F7以外のステータスでもSysExは終わる
+    if (inSysEx)
+    {
+      if (byte == 0xF7 && sysExLength < MIDI_SYSEX_SIZE) sysEx[sysExLength++] = byte;
+      EndSysEx();
+    }
+    // 対応するF0の無いF7も、他のシステムコモンと同じくランニングステータスを解除する
+    if (byte == 0xF7)
+    {
+      message[0] = 0;
+      dataCount = 0;
+      return;
+    }
+
+    message[0] = byte;
+    dataCount = 0;
+    dataLength = DataLength(byte);
+    if (byte == 0xF0)
+    {
+      message[0] = 0;
+      inSysEx = true;
+      sysEx[0] = byte;
+      sysExLength = 1;
+    }
+    else if (byte == 0xF6) // チューンリクエスト
+    {
+      if (onMessage != nullptr) onMessage(message, 1);
+      message[0] = 0;
+    }
+    else if (byte == 0xF4 || byte == 0xF5) // 未定義
+    {
+      message[0] = 0;
+    }
+    return;
+  }
+
+  if (inSysEx)
+  {
+    if (sysExLength < MIDI_SYSEX_SIZE) sysEx[sysExLength++] = byte;
+    else if (sysExLength == MIDI_SYSEX_SIZE)
+    {
+      sysExOverflows++;
+      sysExLength++; // 数えるのは1回だけ
+    }
+    return;
+  }
+
+  // ステータスを受け取っていないデータバイトは捨てる
+  if (message[0] == 0) return;
+
+  message[1 + dataCount++] = byte;
+  if (dataCount < dataLength) return;
+  if (onMessage != nullptr) onMessage(message, 1 + dataLength);
+  dataCount = 0;
+  // システムコモンはランニングステータスの対象外
+  if (message[0] >= 0xF0) message[0] = 0;
+}
+
+void MidiParser::Reset()
+{
+  message[0] = 0;
+  dataCount = 0;
+  inSysEx = false;
+  sysExLength = 0;
+}
+
+void MidiParser::EndSysEx()
+{
+  inSysEx = false;
+  size_t length = sysExLength < MIDI_SYSEX_SIZE ? sysExLength : MIDI_SYSEX_SIZE;
+  if (onSysEx != nullptr) onSysEx(sysEx, length);
+  sysExLength = 0;
+}
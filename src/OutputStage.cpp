@@ -0,0 +1,66 @@
+#include "OutputStage.h"
+#include "Profiler.h"
+
+enum OutputClip outputClip = ClipHard;
+bool outputDither = false;
+
+namespace
+{
+  uint32_t ditherState = 0x12345678;
+
+  // xorshift32 上位・下位16bitを2つの一様乱数として使う
+  inline uint32_t NextRandom()
+  {
+    ditherState ^= ditherState << 13;
+    ditherState ^= ditherState >> 17;
+    ditherState ^= ditherState << 5;
+    return ditherState;
+  }
+
+  // 2つの一様乱数の差で -1〜1 LSB の三角分布を作る
+  inline float TriangularDither()
+  {
+    uint32_t r = NextRandom();
+    return ((int32_t)(r & 0xFFFF) - (int32_t)(r >> 16)) * (1.0f / 65536.0f);
+  }
+
+  // ニーより上を d/(1+d) で圧縮する ニーでの傾きは1で、フルスケールに漸近する
+  inline float SoftClip(float x)
+  {
+    const float knee = SOFT_CLIP_KNEE * 32767.0f;
+    const float range = 32767.0f - knee;
+    float magnitude = x < 0 ? -x : x;
+    if (magnitude <= knee) return x;
+    float d = (magnitude - knee) / range;
+    float y = knee + range * d / (1.0f + d);
+    return x < 0 ? -y : y;
+  }
+
+  template <OutputClip C, bool Dither>
+  void Convert(const float *data, int16_t *dataI)
+  {
+    for (uint16_t i = 0; i < SAMPLE_BUFFER_SIZE * OUTPUT_CHANNELS; i++)
+    {
+      float x = data[i] * masterVolume;
+      if (C == ClipSoft) x = SoftClip(x);
+      if (Dither) x += TriangularDither();
+      dataI[i] = SaturateInt16((int32_t)x);
+    }
+  }
+}
+
+void ConvertOutput(const float *data, int16_t *dataI)
+{
+  uint32_t startCycles = CycleCount();
+  if (outputClip == ClipSoft)
+  {
+    if (outputDither) Convert<ClipSoft, true>(data, dataI);
+    else Convert<ClipSoft, false>(data, dataI);
+  }
+  else
+  {
+    if (outputDither) Convert<ClipHard, true>(data, dataI);
+    else Convert<ClipHard, false>(data, dataI);
+  }
+  profiler.Record(ProfileOutput, CycleCount() - startCycles);
+}
@@ -0,0 +1,110 @@
+#include "Profiler.h"
+
+#include <stdio.h>
+
+Profiler profiler;
+
+namespace
+{
+  const char *stageNames[PROFILE_STAGE_COUNT] = {
+      "voice",
+      "adsr",
+      "ghost",
+      "decode",
+      "reverb",
+      "limiter",
+      "output",
+      "i2s_write",
+      "block",
+  };
+
+  // 1オクターブを4分割した対数ビン (8未満はそのまま)
+  inline uint8_t HistogramBin(uint32_t v)
+  {
+    if (v < 8) return v;
+    uint8_t msb = 31 - __builtin_clz(v);
+    return (msb - 1) * 4 + ((v >> (msb - 2)) & 3);
+  }
+
+  inline uint32_t BinLowerBound(uint8_t bin)
+  {
+    if (bin < 8) return bin;
+    uint8_t msb = bin / 4 + 1;
+    return (uint32_t)(4 + bin % 4) << (msb - 2);
+  }
+}
+
+void Profiler::Collect()
+{
+  uint32_t tail = ringTail.load(std::memory_order_relaxed);
+  uint32_t head = ringHead.load(std::memory_order_acquire);
+  while (tail != head)
+  {
+    uint32_t entry = ring[tail & (PROFILER_RING_SIZE - 1)];
+    tail++;
+    Stats &s = stats[entry >> 28];
+    uint32_t cycles = entry & 0x0FFFFFFF;
+    if (s.count == 0 || cycles < s.min) s.min = cycles;
+    if (cycles > s.max) s.max = cycles;
+    s.count++;
+    s.sum += cycles;
+    s.latest = cycles;
+    s.histogram[HistogramBin(cycles)]++;
+  }
+  ringTail.store(tail, std::memory_order_release);
+}
+
+uint32_t Profiler::Percentile(ProfileStage stage, float percent) const
+{
+  const Stats &s = stats[stage];
+  if (s.count == 0) return 0;
+  uint32_t threshold = (uint32_t)(s.count * percent / 100.0f);
+  uint32_t total = 0;
+  for (uint8_t bin = 0; bin < PROFILER_HISTOGRAM_BINS; bin++)
+  {
+    total += s.histogram[bin];
+    if (total > threshold)
+    {
+      uint32_t upper = bin + 1 < PROFILER_HISTOGRAM_BINS ? BinLowerBound(bin + 1) - 1 : s.max;
+      return upper < s.max ? upper : s.max;
+    }
+  }
+  return s.max;
+}
+
+void Profiler::Dump(void (*print)(const char *line))
+{
+  Collect();
+  char line[96];
+  uint32_t perUs = CyclesPerMicrosecond();
+  snprintf(line, sizeof(line), "stage          count       min       avg       max       p99  (cycles, %lu/us)",
+           (unsigned long)perUs);
+  print(line);
+  for (uint8_t i = 0; i < PROFILE_STAGE_COUNT; i++)
+  {
+    const Stats &s = stats[i];
+    if (s.count == 0) continue;
+    snprintf(line, sizeof(line), "%-10s %9lu %9lu %9lu %9lu %9lu",
+             stageNames[i], (unsigned long)s.count, (unsigned long)s.min,
+             (unsigned long)(s.sum / s.count), (unsigned long)s.max,
+             (unsigned long)Percentile((ProfileStage)i, 99.0f));
+    print(line);
+  }
+  uint32_t lost = dropped.exchange(0, std::memory_order_relaxed);
+  if (lost > 0)
+  {
+    snprintf(line, sizeof(line), "dropped %lu samples", (unsigned long)lost);
+    print(line);
+  }
+  Reset();
+}
+
+void Profiler::Reset()
+{
+  for (uint8_t i = 0; i < PROFILE_STAGE_COUNT; i++)
+  {
+    uint32_t latest = stats[i].latest;
+    stats[i] = Stats();
+    stats[i].latest = latest;
+  }
+}
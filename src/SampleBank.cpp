@@ -0,0 +1,118 @@
+#include "SampleBank.h"
+
+#include <string.h>
+
+#ifdef ARDUINO
+#include <esp_partition.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool LoadSampleBank(SampleBank *bank, const void *data, uint32_t size)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+  BankHeader header;
+  if (size < sizeof(header)) return false;
+  memcpy(&header, bytes, sizeof(header));
+  if (memcmp(header.magic, BANK_MAGIC, 4) != 0 || header.version != BANK_VERSION) return false;
+  if (header.sampleCount > BANK_MAX_SAMPLES || header.zoneCount == 0 || header.zoneCount > BANK_MAX_ZONES) return false;
+  if (header.size > size) return false;
+  size = header.size;
+
+  uint32_t offset = sizeof(header);
+  if (offset + header.sampleCount * sizeof(BankSample) + header.zoneCount * sizeof(BankZone) > size) return false;
+
+  for (uint16_t i = 0; i < header.sampleCount; i++, offset += sizeof(BankSample))
+  {
+    BankSample entry;
+    memcpy(&entry, bytes + offset, sizeof(entry));
+    if (entry.loopEnd > entry.length || (entry.adsrEnabled && entry.loopStart >= entry.loopEnd)) return false;
+    if (entry.loopStart > entry.loopEnd || entry.encoding > BankImaAdpcm) return false;
+    uint64_t payloadSize = entry.encoding == BankImaAdpcm ? AdpcmSize(entry.length, entry.loopStart, entry.loopEnd) : (uint64_t)entry.length * 2;
+    if (entry.offset % BANK_ALIGN != 0 || entry.offset > size || payloadSize > size - entry.offset) return false;
+    if (entry.root > 127 || entry.interpolation > InterpolationSinc) return false;
+
+    Sample &sample = bank->samples[i];
+    sample.sample = entry.encoding == BankPcm16 ? (const int16_t *)(bytes + entry.offset) : nullptr;
+    sample.adpcm = entry.encoding == BankImaAdpcm ? bytes + entry.offset : nullptr;
+    sample.stream = nullptr;
+    sample.residentLength = 0;
+    sample.length = entry.length;
+    sample.root = entry.root;
+    sample.loopStart = entry.loopStart;
+    sample.loopEnd = entry.loopEnd;
+    sample.adsrEnabled = entry.adsrEnabled != 0;
+    sample.attack = entry.attack;
+    sample.decay = entry.decay;
+    sample.sustain = entry.sustain;
+    sample.release = entry.release;
+    sample.interpolation = (SampleInterpolation)entry.interpolation;
+  }
+
+  for (uint16_t i = 0; i < header.zoneCount; i++, offset += sizeof(BankZone))
+  {
+    BankZone entry;
+    memcpy(&entry, bytes + offset, sizeof(entry));
+    if (entry.sample >= header.sampleCount) return false;
+    bank->zones[i] = {&bank->samples[entry.sample], entry.noteLow, entry.noteHigh, entry.velocityLow, entry.velocityHigh};
+  }
+
+  bank->data = bytes;
+  bank->size = size;
+  bank->sampleCount = header.sampleCount;
+  bank->instrument.zones = bank->zones;
+  bank->instrument.zoneCount = header.zoneCount;
+  // ベロシティで切り替えるゾーンが多すぎるバンクは読み込まない
+  return InitInstrument(&bank->instrument);
+}
+
+#ifdef ARDUINO
+
+bool MapSampleBank(SampleBank *bank, const char *name)
+{
+  const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, name);
+  if (partition == nullptr) return false;
+
+  // ヘッダに書かれた大きさだけをマップする (データ用のMMUは最大4MB)
+  BankHeader header;
+  if (esp_partition_read(partition, 0, &header, sizeof(header)) != ESP_OK) return false;
+  if (header.size < sizeof(header) || header.size > partition->size) return false;
+
+  const void *data;
+  spi_flash_mmap_handle_t handle;
+  if (esp_partition_mmap(partition, 0, header.size, SPI_FLASH_MMAP_DATA, &data, &handle) != ESP_OK) return false;
+  if (!LoadSampleBank(bank, data, header.size))
+  {
+    spi_flash_munmap(handle);
+    return false;
+  }
+  return true;
+}
+
+#else
+
+bool MapSampleBank(SampleBank *bank, const char *name)
+{
+  int fd = open(name, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size > UINT32_MAX)
+  {
+    close(fd);
+    return false;
+  }
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return false;
+  if (!LoadSampleBank(bank, data, (uint32_t)st.st_size))
+  {
+    munmap(data, st.st_size);
+    return false;
+  }
+  return true;
+}
+
+#endif
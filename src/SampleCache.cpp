@@ -0,0 +1,196 @@
+#include "SampleCache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <esp_heap_caps.h>
+#endif
+
+SampleCache sampleCache;
+
+namespace
+{
+  int16_t *AllocateCache(uint32_t bytes, bool internal)
+  {
+#ifdef ARDUINO
+    void *memory = internal ? nullptr : heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+    if (memory == nullptr) memory = heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    return (int16_t *)memory;
+#else
+    return (int16_t *)malloc(bytes);
+#endif
+  }
+
+  void FreeCache(int16_t *memory)
+  {
+#ifdef ARDUINO
+    heap_caps_free(memory);
+#else
+    free(memory);
+#endif
+  }
+}
+
+void InitSampleCache(Sample *sample)
+{
+  for (SampleRegion &region : sample->regions)
+  {
+    region.start = region.end = 0;
+    region.data.store(nullptr, std::memory_order_relaxed);
+  }
+  // ADPCMは展開したブロックから読むのでキャッシュしない
+  if (sample->sample == nullptr) return;
+
+  uint32_t available = sample->stream != nullptr ? sample->residentLength : sample->length;
+  uint32_t headEnd = available < SAMPLE_CACHE_HEAD ? available : SAMPLE_CACHE_HEAD;
+  sample->regions[0].end = headEnd;
+
+  // ループ区間は補間のタップも含める
+  if (sample->adsrEnabled)
+  {
+    uint32_t loopStart = sample->loopStart > INTERPOLATION_TAPS_BEFORE ? sample->loopStart - INTERPOLATION_TAPS_BEFORE : 0;
+    uint32_t loopEnd = sample->loopEnd + INTERPOLATION_TAPS_AFTER;
+    if (loopEnd > available) loopEnd = available;
+    if (loopEnd > headEnd)
+    {
+      sample->regions[1].start = loopStart;
+      sample->regions[1].end = loopEnd;
+    }
+  }
+}
+
+void SampleCache::Touch(Sample *sample)
+{
+  if ((capacity == 0 && pinned == 0) || sample->regions[0].end == 0) return;
+
+  bool hit = true;
+  for (const SampleRegion &region : sample->regions)
+  {
+    if (region.end != region.start && region.data.load(std::memory_order_relaxed) == nullptr) hit = false;
+  }
+  (hit ? hits : misses).fetch_add(1, std::memory_order_relaxed);
+
+  // ヒットした場合も、最後にノートオンされた順番を更新するために積む
+  uint32_t head = requestHead.load(std::memory_order_relaxed);
+  if (head - requestTail.load(std::memory_order_acquire) >= SAMPLE_CACHE_REQUESTS) return;
+  requests[head & (SAMPLE_CACHE_REQUESTS - 1)] = sample;
+  requestHead.store(head + 1, std::memory_order_release);
+}
+
+void SampleCache::Service()
+{
+  FreeRetired();
+
+  uint32_t tail = requestTail.load(std::memory_order_relaxed);
+  while (tail != requestHead.load(std::memory_order_acquire))
+  {
+    Sample *sample = requests[tail & (SAMPLE_CACHE_REQUESTS - 1)];
+    requestTail.store(++tail, std::memory_order_release);
+    useCount++;
+
+    Entry *entry = Find(sample);
+    if (entry == nullptr) continue;
+    entry->lastUse = useCount;
+    if (entry->memory == nullptr) Load(*entry, false);
+  }
+}
+
+bool SampleCache::Pin(Sample *sample)
+{
+  Entry *entry = Find(sample);
+  if (entry == nullptr) return false;
+  if (entry->pinned) return true;
+  if (entry->memory != nullptr) Evict(*entry);
+  if (entry->memory != nullptr) return false;
+
+  uint32_t bytes = 0;
+  for (const SampleRegion &region : sample->regions) bytes += (region.end - region.start) * sizeof(int16_t);
+  if (bytes == 0 || pinned + bytes > SAMPLE_PIN_BYTES) return false;
+  if (!Load(*entry, true)) return false;
+  // 固定した分は capacity に含めない
+  used -= bytes;
+  pinned += bytes;
+  entry->pinned = true;
+  return true;
+}
+
+// 既にあればその項目を、無ければ空きか最も昔に使われた項目を返す
+SampleCache::Entry *SampleCache::Find(Sample *sample)
+{
+  Entry *oldest = nullptr;
+  for (Entry &e : entries)
+  {
+    if (e.sample == sample) return &e;
+    if (e.pinned) continue;
+    if (oldest == nullptr || (oldest->sample != nullptr && (e.sample == nullptr || e.lastUse < oldest->lastUse))) oldest = &e;
+  }
+  if (oldest == nullptr) return nullptr;
+  if (oldest->memory != nullptr) Evict(*oldest);
+  if (oldest->memory != nullptr) return nullptr; // 解放待ちが一杯
+  oldest->sample = sample;
+  oldest->lastUse = 0;
+  return oldest;
+}
+
+bool SampleCache::Load(Entry &entry, bool internal)
+{
+  Sample *sample = entry.sample;
+  uint32_t bytes = 0;
+  for (const SampleRegion &region : sample->regions) bytes += (region.end - region.start) * sizeof(int16_t);
+  if (!internal && bytes > capacity) return false;
+
+  // 容量を超える分は、最も昔にノートオンされたSampleから追い出す
+  while (!internal && used + bytes > capacity)
+  {
+    Entry *victim = nullptr;
+    for (Entry &e : entries)
+    {
+      if (&e != &entry && e.memory != nullptr && !e.pinned && (victim == nullptr || e.lastUse < victim->lastUse)) victim = &e;
+    }
+    if (victim == nullptr) return false;
+    Evict(*victim);
+    if (victim->memory != nullptr) return false;
+  }
+
+  int16_t *memory = AllocateCache(bytes, internal);
+  if (memory == nullptr) return false;
+  entry.memory = memory;
+  entry.bytes = bytes;
+  used += bytes;
+
+  for (SampleRegion &region : sample->regions)
+  {
+    if (region.end == region.start) continue;
+    memcpy(memory, sample->sample + region.start, (region.end - region.start) * sizeof(int16_t));
+    region.data.store(memory, std::memory_order_release);
+    memory += region.end - region.start;
+  }
+  return true;
+}
+
+void SampleCache::Evict(Entry &entry)
+{
+  if (retiredCount == SAMPLE_CACHE_ENTRIES) return;
+  for (SampleRegion &region : entry.sample->regions) region.data.store(nullptr, std::memory_order_release);
+  // オーディオタスクが処理中のブロックでまだ読んでいるかもしれないので、すぐには解放しない
+  retired[retiredCount++] = {entry.memory, entry.bytes, CurrentFrame()};
+  used -= entry.bytes;
+  entry.memory = nullptr;
+  entry.bytes = 0;
+}
+
+void SampleCache::FreeRetired()
+{
+  uint32_t frame = CurrentFrame();
+  for (uint8_t i = 0; i < retiredCount;)
+  {
+    // CurrentFrame() が2ブロック進めば、追い出した時に処理中だったブロックは終わっている
+    if ((int32_t)(frame - retired[i].frame) >= 2 * SAMPLE_BUFFER_SIZE)
+    {
+      FreeCache(retired[i].memory);
+      retired[i] = retired[--retiredCount];
+    }
+    else i++;
+  }
+}
@@ -0,0 +1,115 @@
+#include "SampleStream.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#ifdef ARDUINO
+#include <esp_heap_caps.h>
+#endif
+
+StreamBuffer *streamBuffers = nullptr;
+
+static std::atomic<uint32_t> underruns{0};
+
+// 1つあたり約4KBあるので、ストリーミングしない構成では確保しない
+static bool AllocateStreamBuffers()
+{
+  if (streamBuffers != nullptr) return true;
+  size_t bytes = sizeof(StreamBuffer) * MAX_SOUND;
+#ifdef ARDUINO
+  void *memory = heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#else
+  void *memory = malloc(bytes);
+#endif
+  if (memory == nullptr) return false;
+  StreamBuffer *buffers = (StreamBuffer *)memory;
+  for (uint8_t i = 0; i < MAX_SOUND; i++) new (&buffers[i]) StreamBuffer();
+  streamBuffers = buffers;
+  return true;
+}
+
+bool OpenSampleStream(SampleStream *stream, const char *path, uint32_t dataOffset)
+{
+  stream->file = fopen(path, "rb");
+  stream->dataOffset = dataOffset;
+  if (stream->file == nullptr) return false;
+  if (!AllocateStreamBuffers())
+  {
+    fclose(stream->file);
+    stream->file = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void StreamBuffer::Start(const Sample *sample)
+{
+  generation++;
+  this->sample.store(sample, std::memory_order_relaxed);
+  uint32_t tag = (uint32_t)generation << 16;
+  wanted[0].store(tag | 0, std::memory_order_release);
+  wanted[1].store(tag | 1, std::memory_order_release);
+}
+
+const int16_t *StreamBuffer::Acquire(uint32_t chunk)
+{
+  uint32_t tag = ((uint32_t)generation << 16) | chunk;
+  uint8_t slot = chunk & 1;
+  if (loaded[slot].load(std::memory_order_acquire) != tag)
+  {
+    // 間に合わなかった場合も、今の位置のチャンクとその次を要求し直す
+    // 要求しなければ次のチャンクも読まれず、以降ずっと無音になる
+    wanted[slot].store(tag, std::memory_order_release);
+    wanted[slot ^ 1].store(tag + 1, std::memory_order_release);
+    return nullptr;
+  }
+  // 前のチャンクを読み終えたので、空いた方に次を要求する
+  wanted[slot ^ 1].store(tag + 1, std::memory_order_release);
+  return data[slot];
+}
+
+void StreamBuffer::Fill()
+{
+  for (uint8_t slot = 0; slot < 2; slot++)
+  {
+    uint32_t tag = wanted[slot].load(std::memory_order_acquire);
+    if (tag == 0xFFFFFFFF || loaded[slot].load(std::memory_order_relaxed) == tag) continue;
+    const Sample *s = sample.load(std::memory_order_relaxed);
+    if (s == nullptr || s->stream == nullptr) continue;
+    loaded[slot].store(0xFFFFFFFF, std::memory_order_release);
+
+    // チャンクの前後のガードも含めて読み込み、波形の範囲外は0にする
+    int64_t first = (int64_t)StreamStart(s) + (int64_t)(tag & 0xFFFF) * STREAM_CHUNK - STREAM_GUARD_BEFORE;
+    int64_t last = first + STREAM_GUARD_BEFORE + STREAM_CHUNK + STREAM_GUARD_AFTER;
+    int16_t *buffer = data[slot];
+    memset(buffer, 0, sizeof(data[slot]));
+    int64_t begin = first < 0 ? 0 : first;
+    int64_t end = last > s->length ? s->length : last;
+    if (begin < end)
+    {
+      fseek(s->stream->file, s->stream->dataOffset + begin * 2, SEEK_SET);
+      fread(buffer + (begin - first), 2, end - begin, s->stream->file);
+    }
+
+    // 読み込み中に別のノートで上書きされていたら捨てる
+    if (wanted[slot].load(std::memory_order_acquire) == tag)
+      loaded[slot].store(tag, std::memory_order_release);
+  }
+}
+
+void ServiceSampleStreams()
+{
+  if (streamBuffers == nullptr) return;
+  for (uint8_t i = 0; i < MAX_SOUND; i++) streamBuffers[i].Fill();
+}
+
+uint32_t StreamUnderruns()
+{
+  return underruns.load(std::memory_order_relaxed);
+}
+
+void CountStreamUnderrun()
+{
+  underruns.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,752 @@
+#include "Sampler.h"
+#include "Profiler.h"
+#include "VoiceAllocator.h"
+#include "Instrument.h"
+#include "SampleStream.h"
+#include "SampleCache.h"
+
+extern const int16_t piano_sample[128000];
+
+float masterVolume = 0.5f;
+
+struct Sample piano = {
+    piano_sample,
+    128000,
+    60,
+    24120,
+    24288,
+    true,
+    1.0f,
+    1300.0f,
+    0.1f,
+    130.0f,
+    InterpolationHermite};
+
+static const SampleZone pianoZones[] = {
+    {&piano, 0, 127, 0, 127},
+};
+Instrument pianoInstrument = {pianoZones, sizeof(pianoZones) / sizeof(pianoZones[0])};
+
+MidiChannel channels[MIDI_CHANNELS];
+static Instrument *programs[128];
+
+void SetInstrument(Instrument *instrument)
+{
+  for (uint8_t i = 0; i < MIDI_CHANNELS; i++) channels[i].instrument = instrument;
+}
+
+void SetInstrument(uint8_t channel, Instrument *instrument)
+{
+  channels[channel & 0x0F].instrument = instrument;
+}
+
+void SetProgram(uint8_t program, Instrument *instrument)
+{
+  programs[program & 0x7F] = instrument;
+}
+
+SamplePlayer players[MAX_SOUND] = {SamplePlayer()};
+
+// 発音中に止められたボイスは、ここに移して短くフェードアウトさせてから止める
+static SamplePlayer ghosts[GHOST_SOUND];
+static uint32_t ghostRemaining[GHOST_SOUND]; // フェードアウト終了までのサンプル数 0なら空き
+
+#define PITCH_TABLE_RANGE 127 // 半音単位の表の範囲 (±)
+#define PITCH_FINE_STEPS 128 // 半音未満の表の分割数
+
+// 再生速度の表 pow() をオーディオ処理中に呼ばないよう起動時に計算しておく
+static float semitoneRatios[PITCH_TABLE_RANGE * 2 + 1];
+static float fineRatios[PITCH_FINE_STEPS];
+
+
+// 定パワーパンのゲイン [pan][L/R]
+static float panTable[128][2];
+
+void InitSampler()
+{
+  InitInterpolation();
+  InitInstrument(&pianoInstrument);
+  for (uint8_t i = 0; i < MIDI_CHANNELS; i++)
+  {
+    channels[i] = MidiChannel();
+    channels[i].instrument = &pianoInstrument;
+    channels[i].volume = 1.0f;
+    channels[i].bendRange = PITCH_BEND_RANGE;
+    channels[i].pan = 64;
+    channels[i].rpn = RPN_NULL;
+  }
+  for (int i = 0; i < 128; i++)
+  {
+    // 64がちょうど中央になるよう、1〜127を0〜π/2に割り当てる
+    float angle = (i > 0 ? i - 1 : 0) / 126.0f * 1.57079633f;
+    panTable[i][0] = cosf(angle);
+    panTable[i][1] = sinf(angle);
+  }
+  for (int i = 0; i < PITCH_TABLE_RANGE * 2 + 1; i++)
+    semitoneRatios[i] = pow(2.0f, (i - PITCH_TABLE_RANGE) / 12.0f);
+  for (int i = 0; i < PITCH_FINE_STEPS; i++)
+    fineRatios[i] = pow(2.0f, i / (12.0f * PITCH_FINE_STEPS));
+}
+
+float PitchFromNoteNo(uint8_t noteNo, uint8_t root, float pitchBend)
+{
+  float delta = (int)noteNo - (int)root + pitchBend;
+  float whole = floorf(delta);
+  int index = (int)whole + PITCH_TABLE_RANGE;
+  if (index < 0) return semitoneRatios[0];
+  if (index > PITCH_TABLE_RANGE * 2) return semitoneRatios[PITCH_TABLE_RANGE * 2];
+  int fine = (int)((delta - whole) * PITCH_FINE_STEPS);
+  if (fine >= PITCH_FINE_STEPS) fine = PITCH_FINE_STEPS - 1;
+  return semitoneRatios[index] * fineRatios[fine];
+}
+
+void InitSampleAdsr(Sample *sample)
+{
+  const float blockMs = SAMPLE_BUFFER_SIZE * 1000.0f / SAMPLE_RATE;
+  sample->attackStep = sample->attack > blockMs ? blockMs / sample->attack : 1.0f;
+  sample->decayCoef = expf(-blockMs / sample->decay);
+  // リリースベロシティが大きいほど短く、小さいほど長くする
+  for (int i = 0; i < RELEASE_VELOCITY_STEPS; i++)
+  {
+    int velocity = i << RELEASE_VELOCITY_SHIFT;
+    float release = sample->release * powf(RELEASE_VELOCITY_RANGE, (64 - velocity) / 64.0f);
+    sample->releaseCoefs[i] = expf(-blockMs / release);
+  }
+}
+
+// ブロック終端でのゲインを求める ブロック内はRenderPlayerで直線補間する
+inline void UpdateAdsr(SamplePlayer *player)
+{
+  Sample *sample = player->sample;
+  if(player->released) player->adsrState = release;
+
+  switch (player->adsrState)
+  {
+  case attack:
+    player->adsrGain += sample->attackStep;
+    if (player->adsrGain >= 1.0f)
+    {
+      player->adsrGain = 1.0f;
+      player->adsrState = decay;
+    }
+    break;
+  case decay:
+    player->adsrGain = (player->adsrGain - sample->sustain) * sample->decayCoef + sample->sustain;
+    if ((player->adsrGain - sample->sustain) < 0.01f)
+    {
+      player->adsrState = sustain;
+      player->adsrGain = sample->sustain;
+    }
+    break;
+  case sustain:
+    break;
+  case release:
+    player->adsrGain *= player->releaseCoef;
+    // 0までフェードしたブロックを描画した後に停止する
+    if (player->adsrGain < 0.01f) player->adsrGain = 0;
+    break;
+  }
+}
+
+void SetPan(SamplePlayer *player, uint8_t pan)
+{
+  player->panLeft = panTable[pan & 0x7F][0];
+  player->panRight = panTable[pan & 0x7F][1];
+}
+
+// frames サンプル分のゲインの傾きを求める
+// 現在のゲインから直線で変化させるので、チャンネルの音量の変化も滑らかになる
+static void UpdateEnvelope(SamplePlayer *player, uint32_t frames)
+{
+  float volume = player->volume * channels[player->channel].volume;
+  if (player->sample->adsrEnabled) UpdateAdsr(player);
+  float target = player->sample->adsrEnabled ? volume * player->adsrGain : volume;
+  player->gainStep = (target - player->gain) / frames;
+}
+
+// ブロック終端での再生速度を求め、frames サンプルかけて位相の増分を直線で変化させる
+// ピッチベンド・ビブラートによる変化を、波形生成中に指数関数を計算せずに滑らかにする
+static void UpdatePitch(SamplePlayer *player, uint32_t frames)
+{
+  const MidiChannel &channel = channels[player->channel];
+  player->pitch = PitchFromNoteNo(player->noteNo, player->sample->root, channel.pitchBend + channel.vibrato);
+  int64_t target = (int64_t)((double)player->pitch * PHASE_ONE);
+  player->phaseIncrementStep = (target - (int64_t)player->phaseIncrement) / (int64_t)frames;
+}
+
+// チャンネルのLFOを1ブロック分進め、このブロックのビブラートの量を求める
+static void UpdateVibrato(MidiChannel *channel)
+{
+  float depth = channel->modulation * (VIBRATO_DEPTH / 127.0f) + channel->pressure * (PRESSURE_VIBRATO_DEPTH / 127.0f);
+  if (depth == 0.0f)
+  {
+    // 次にかけ始める時は音程の中心から揺らす
+    channel->lfoPhase = 0.0f;
+    channel->vibrato = 0.0f;
+    return;
+  }
+  channel->lfoPhase += VIBRATO_RATE * SAMPLE_BUFFER_SIZE / SAMPLE_RATE;
+  if (channel->lfoPhase >= 1.0f) channel->lfoPhase -= 1.0f;
+  channel->vibrato = depth * sinf(channel->lfoPhase * 6.28318531f);
+}
+
+static uint32_t blockFrame = 0;  // 処理中のブロック先頭のサンプル位置
+static uint32_t eventOffset = 0; // 処理中のイベントのブロック内の位置
+
+static void StartPlayer(uint8_t id, uint8_t channel, Sample *sample, uint8_t noteNo, uint8_t velocity)
+{
+  SamplePlayer *player = &players[id];
+  // 前にこのボイスを使っていたチャンネルのペダルの状態から外す
+  MidiChannel &previous = channels[player->channel];
+  previous.keyDown.Remove(id);
+  previous.pedalHeld.Remove(id);
+  previous.sostenutoVoices.Remove(id);
+  channels[channel].keyDown.Add(id);
+
+  float volume = velocity / 127.0f;
+  if (channels[channel].soft) volume *= SOFT_PEDAL_GAIN;
+  *player = SamplePlayer(sample, noteNo, volume);
+  player->channel = channel;
+  player->releaseCoef = sample->releaseCoefs[64 >> RELEASE_VELOCITY_SHIFT];
+  if (sample->stream != nullptr)
+  {
+    player->stream = &streamBuffers[id];
+    player->stream->Start(sample);
+  }
+  SetPitch(player, PitchFromNoteNo(noteNo, sample->root, channels[channel].pitchBend + channels[channel].vibrato));
+  SetPan(player, channels[channel].pan);
+  // ADSRが無ければ最初から音量通りに鳴らす
+  if (sample->adsrEnabled == false) player->gain = player->volume * channels[channel].volume;
+  // ブロックの途中から発音する場合は残りのサンプル数で立ち上げる
+  UpdateEnvelope(player, SAMPLE_BUFFER_SIZE - eventOffset);
+}
+
+// 止めるPlayerを予備の枠に移してフェードアウトさせる
+static void StartGhost(const SamplePlayer *player)
+{
+  // 空きが無ければ、最もフェードアウトが進んでいるものを打ち切る
+  uint8_t slot = 0;
+  for (uint8_t i = 1; i < GHOST_SOUND; i++)
+  {
+    if (ghostRemaining[i] < ghostRemaining[slot]) slot = i;
+  }
+  const uint32_t fadeSamples = GHOST_FADE_MS * SAMPLE_RATE / 1000;
+  ghosts[slot] = *player;
+  // バッファは新しい音が使うので、ストリーミング部分は鳴らさない
+  ghosts[slot].stream = nullptr;
+  ghosts[slot].gainStep = -player->gain / fadeSamples;
+  ghosts[slot].phaseIncrementStep = 0;
+  ghostRemaining[slot] = fadeSamples;
+}
+
+void SendNoteOn(uint8_t noteNo, uint8_t velocity, uint8_t channnel) {
+  // 全てのPlayerが再生中だった時には、voiceAllocator.policy に従って選んだPlayerを
+  // フェードアウトさせて新しい音に使う
+  channnel &= 0x0F;
+  if (channels[channnel].instrument == nullptr) return;
+  Sample *sample = FindSample(channels[channnel].instrument, noteNo, velocity);
+  if (sample == nullptr) return;
+  sampleCache.Touch(sample);
+  bool stolen;
+  uint8_t id = voiceAllocator.Allocate(channnel, noteNo, &stolen);
+  if (id == VOICE_NONE) return; // チャンネルの上限・他のチャンネルの予約で鳴らせない
+  if (stolen && players[id].playing) StartGhost(&players[id]);
+  StartPlayer(id, channnel, sample, noteNo, velocity);
+}
+// ボイスの集合をまとめてリリースする
+static void ReleaseVoices(VoiceMask voices)
+{
+  while (voices.Any())
+  {
+    uint8_t i = voices.PopLowest();
+    players[i].released = true;
+    voiceAllocator.Release(i);
+  }
+}
+
+void SendNoteOff(uint8_t noteNo,  uint8_t velocity, uint8_t channnel) {
+  if (velocity == 0) velocity = 64;
+  channnel &= 0x0F;
+  MidiChannel &channel = channels[channnel];
+  // ペダルで保持するボイス
+  VoiceMask hold = channel.sustain ? VoiceMask::All() : (channel.sostenuto ? channel.sostenutoVoices : VoiceMask());
+  VoiceMask released;
+  // 押している鍵盤のボイスの集合から1つずつ取り出して辿る
+  for (VoiceMask mask = channel.keyDown & voiceAllocator.ChannelVoices(channnel); mask.Any();) {
+    uint8_t i = mask.PopLowest();
+    if(players[i].noteNo == noteNo) {
+      // リリースベロシティはペダルで保持する場合も離鍵した時のものを使う
+      players[i].releaseCoef = players[i].sample->releaseCoefs[(velocity & 0x7F) >> RELEASE_VELOCITY_SHIFT];
+      released.Add(i);
+    }
+  }
+  channel.keyDown &= ~released;
+  channel.pedalHeld |= released & hold;
+  ReleaseVoices(released & ~hold);
+}
+
+static void SetSustain(uint8_t channnel, bool on)
+{
+  MidiChannel &channel = channels[channnel];
+  channel.sustain = on;
+  if (on) return;
+  // ソステヌートで保持しているもの以外をまとめてリリースする
+  VoiceMask released = channel.pedalHeld & ~(channel.sostenuto ? channel.sostenutoVoices : VoiceMask());
+  channel.pedalHeld &= ~released;
+  ReleaseVoices(released);
+}
+
+// 踏んだ時に押している鍵盤だけを保持する
+static void SetSostenuto(uint8_t channnel, bool on)
+{
+  MidiChannel &channel = channels[channnel];
+  if (on && !channel.sostenuto) channel.sostenutoVoices = channel.keyDown & voiceAllocator.ChannelVoices(channnel);
+  channel.sostenuto = on;
+  if (on) return;
+  channel.sostenutoVoices = VoiceMask();
+  if (channel.sustain) return;
+  ReleaseVoices(channel.pedalHeld);
+  channel.pedalHeld = VoiceMask();
+}
+
+// チャンネルの全ボイスを直ちに止める 予備の枠(GHOST_SOUND)の数までは短くフェードアウトさせる
+static void StopVoices(uint8_t channnel)
+{
+  for (VoiceMask mask = voiceAllocator.ChannelVoices(channnel); mask.Any();)
+  {
+    uint8_t i = mask.PopLowest();
+    if (players[i].playing) StartGhost(&players[i]);
+    players[i].playing = false;
+    voiceAllocator.Free(i);
+  }
+  channels[channnel].keyDown = VoiceMask();
+  channels[channnel].pedalHeld = VoiceMask();
+  channels[channnel].sostenutoVoices = VoiceMask();
+}
+
+// ピッチベンドの値・幅が変わった時に、発音中のボイスの再生速度をブロックの残りで変化させる
+static void ApplyPitchBend(uint8_t channnel)
+{
+  channels[channnel].pitchBend = channels[channnel].bend * channels[channnel].bendRange / 8192.0f;
+  for (VoiceMask mask = voiceAllocator.ChannelVoices(channnel); mask.Any();)
+    UpdatePitch(&players[mask.PopLowest()], SAMPLE_BUFFER_SIZE - eventOffset);
+}
+
+void SendPitchBend(int16_t value, uint8_t channnel) {
+  channnel &= 0x0F;
+  channels[channnel].bend = value;
+  ApplyPitchBend(channnel);
+}
+
+void SendChannelPressure(uint8_t value, uint8_t channnel) {
+  // ビブラートは次のブロックから反映する
+  channels[channnel & 0x0F].pressure = value & 0x7F;
+}
+
+void SendControlChange(uint8_t control, uint8_t value, uint8_t channnel) {
+  channnel &= 0x0F;
+  value &= 0x7F;
+  switch (control)
+  {
+  case 1: // モジュレーション ビブラートは次のブロックから反映する
+    channels[channnel].modulation = value;
+    break;
+  case 6: // データエントリ RPN 0 はピッチベンドの幅(半音)
+    if (channels[channnel].rpn != 0) break;
+    channels[channnel].bendRange = value;
+    ApplyPitchBend(channnel);
+    break;
+  case 38: // データエントリ LSB RPN 0 ではセント
+    if (channels[channnel].rpn != 0) break;
+    channels[channnel].bendRange = floorf(channels[channnel].bendRange) + (value < 100 ? value : 99) / 100.0f;
+    ApplyPitchBend(channnel);
+    break;
+  case 98: // NRPNは扱わないので、続くデータエントリを無視する
+  case 99:
+    channels[channnel].rpn = RPN_NULL;
+    break;
+  case 100: // RPN LSB
+    channels[channnel].rpn = (channels[channnel].rpn & 0x3F80) | value;
+    break;
+  case 101: // RPN MSB
+    channels[channnel].rpn = (channels[channnel].rpn & 0x7F) | (value << 7);
+    break;
+  case 7: // ボリューム 発音中のボイスには次のブロックから滑らかに反映する
+    channels[channnel].volume = (value / 127.0f) * (value / 127.0f);
+    break;
+  case 10: // パン
+    channels[channnel].pan = value;
+    for (VoiceMask mask = voiceAllocator.ChannelVoices(channnel); mask.Any();)
+      SetPan(&players[mask.PopLowest()], value);
+    break;
+  case 64: // サステイン
+    SetSustain(channnel, value >= 64);
+    break;
+  case 66: // ソステヌート
+    SetSostenuto(channnel, value >= 64);
+    break;
+  case 67: // ソフト 踏んでいる間に発音した音を小さくする
+    channels[channnel].soft = value >= 64;
+    break;
+  case 120: // オールサウンドオフ
+    StopVoices(channnel);
+    break;
+  case 121: // リセットオールコントローラ ボリューム・パン・ベンド幅はそのまま
+  {
+    MidiChannel &channel = channels[channnel];
+    SetSustain(channnel, false);
+    SetSostenuto(channnel, false);
+    channel.soft = false;
+    channel.modulation = 0;
+    channel.pressure = 0;
+    channel.rpn = RPN_NULL;
+    channel.bend = 0;
+    ApplyPitchBend(channnel);
+    break;
+  }
+  case 123: // オールノートオフ 鍵盤・ペダルで保持しているボイスを全てリリースする
+  case 124: // オムニ・モードの切り替えもオールノートオフとして扱う
+  case 125:
+  case 126:
+  case 127:
+  {
+    MidiChannel &channel = channels[channnel];
+    ReleaseVoices((channel.keyDown | channel.pedalHeld) & voiceAllocator.ChannelVoices(channnel));
+    channel.keyDown = VoiceMask();
+    channel.pedalHeld = VoiceMask();
+    channel.sostenutoVoices = VoiceMask();
+    break;
+  }
+  }
+}
+
+void SendProgramChange(uint8_t program, uint8_t channnel) {
+  // 発音中のボイスはそのまま鳴らし続ける
+  Instrument *instrument = programs[program & 0x7F];
+  if (instrument != nullptr) channels[channnel & 0x0F].instrument = instrument;
+}
+
+void HandleMidiMessage(uint8_t *message)
+{
+  uint8_t channel = message[0] & 0x0F;
+  switch (message[0] & 0xF0)
+  {
+  case 0x90:
+    if (message[2] > 0)
+    {
+      SendNoteOn(message[1], message[2], channel);
+      break;
+    }
+    // ベロシティ0のノートオンはリリースベロシティ64のノートオフとして扱う
+    SendNoteOff(message[1], 64, channel);
+    break;
+  case 0x80:
+    SendNoteOff(message[1], message[2], channel);
+    break;
+  case 0xE0:
+    SendPitchBend(((message[2] << 7) | message[1]) - 8192, channel);
+    break;
+  case 0xB0:
+    SendControlChange(message[1], message[2], channel);
+    break;
+  case 0xC0:
+    SendProgramChange(message[1], channel);
+    break;
+  case 0xD0:
+    SendChannelPressure(message[1], channel);
+    break;
+  }
+}
+
+MidiQueue midiQueue;
+
+// loop() 側で時刻からサンプル位置を推定するための、直近のブロック開始時刻
+// 2つの値を一貫して読めるようにシーケンス番号で保護する
+static std::atomic<uint32_t> clockSequence{0};
+static std::atomic<uint32_t> clockFrame{0};
+static std::atomic<uint32_t> clockMicros{0};
+
+static void PublishBlockClock()
+{
+  uint32_t sequence = clockSequence.load(std::memory_order_relaxed);
+  clockSequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  clockFrame.store(blockFrame, std::memory_order_relaxed);
+  clockMicros.store((uint32_t)micros(), std::memory_order_relaxed);
+  clockSequence.store(sequence + 2, std::memory_order_release);
+}
+
+uint32_t CurrentFrame()
+{
+  uint32_t sequence, frame, us;
+  do
+  {
+    sequence = clockSequence.load(std::memory_order_acquire);
+    frame = clockFrame.load(std::memory_order_relaxed);
+    us = clockMicros.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((sequence & 1) || sequence != clockSequence.load(std::memory_order_relaxed));
+
+  uint64_t elapsed = (uint64_t)((uint32_t)micros() - us) * SAMPLE_RATE / 1000000;
+  if (elapsed >= SAMPLE_BUFFER_SIZE) elapsed = SAMPLE_BUFFER_SIZE - 1;
+  // 処理中のブロックには間に合わないので、1ブロック後の同じ位置で鳴らす
+  return frame + (uint32_t)elapsed + SAMPLE_BUFFER_SIZE;
+}
+
+bool PostMidiMessage(uint8_t status, uint8_t data1, uint8_t data2)
+{
+  return PostMidiMessageAt(CurrentFrame(), status, data1, data2);
+}
+
+bool PostMidiMessageAt(uint32_t frame, uint8_t status, uint8_t data1, uint8_t data2)
+{
+  MidiEvent event = {frame, {status, data1, data2}};
+  return midiQueue.Push(event);
+}
+
+// 境界を跨がない区間の波形生成 分岐を含まないので展開しやすい
+// wave[0] は波形の offset サンプル目に当たる
+template <SampleInterpolation I>
+static inline void RenderSpan(const int16_t *wave, uint32_t offset, uint64_t &phase, uint64_t &increment,
+                              int64_t incrementStep, float &gain, float gainStep, float panLeft, float panRight,
+                              float *__restrict data, uint32_t count)
+{
+  uint64_t p = phase;
+  uint64_t inc = increment;
+  float g = gain;
+  for (uint32_t n = 0; n < count; n++)
+  {
+    float val = Interpolate<I>(&wave[(uint32_t)(p >> 32) - offset], (uint32_t)p) * g;
+    data[n * 2] += val * panLeft;
+    data[n * 2 + 1] += val * panRight;
+    g += gainStep;
+    p += inc;
+    inc += incrementStep;
+  }
+  phase = p;
+  increment = inc;
+  gain = g;
+}
+
+// 再生位置が remaining 進む前に読み終える、count 以下のサンプル数
+// 位相の増分は区間内で変化するので、区間内の最大の増分で見積もる
+static inline uint32_t SpanCount(uint64_t remaining, uint64_t increment, int64_t incrementStep, uint32_t count)
+{
+  uint64_t maxIncrement = incrementStep > 0 ? increment + incrementStep * count : increment;
+  if (remaining < maxIncrement * count) count = (remaining + maxIncrement - 1) / maxIncrement;
+  return count;
+}
+
+// 波形の先頭・末尾付近で、範囲外を0として補間する
+template <SampleInterpolation I>
+static inline float InterpolateEdge(const Sample *sample, uint64_t phase)
+{
+  uint32_t pos = phase >> 32;
+  int16_t window[INTERPOLATION_TAPS_BEFORE + 1 + INTERPOLATION_TAPS_AFTER];
+  for (int k = 0; k < INTERPOLATION_TAPS_BEFORE + 1 + INTERPOLATION_TAPS_AFTER; k++)
+  {
+    int64_t index = (int64_t)pos + k - INTERPOLATION_TAPS_BEFORE;
+    window[k] = (index >= 0 && index < sample->length) ? sample->sample[index] : 0;
+  }
+  return Interpolate<I>(&window[INTERPOLATION_TAPS_BEFORE], (uint32_t)phase);
+}
+
+// 補間方法ごとに展開される1ボイス分の波形生成
+// 次の境界(ループ終端・波形末尾)までのサンプル数を先に求め、その区間をまとめて生成する
+template <SampleInterpolation I>
+static void RenderPlayer(SamplePlayer *player, float *data, uint32_t frames)
+{
+  Sample *sample = player->sample;
+  float gain = player->gain;
+  float gainStep = player->gainStep;
+  uint64_t phase = player->phase;
+  uint64_t increment = player->phaseIncrement;
+  int64_t incrementStep = player->phaseIncrementStep;
+  uint64_t loopLength = (uint64_t)(sample->loopEnd - sample->loopStart) << 32;
+  bool looping = sample->adsrEnabled && player->released == false;
+
+  // ストリーミング再生する場合、streamStart 以降はチャンク単位で読み込んだバッファから生成する
+  uint32_t streamStart = sample->stream != nullptr ? StreamStart(sample) : sample->length;
+
+  // 補間のタップが常駐部分からはみ出さず、ループもしない範囲 [INTERPOLATION_TAPS_BEFORE, limit)
+  uint32_t limit = sample->length > INTERPOLATION_TAPS_AFTER ? sample->length - INTERPOLATION_TAPS_AFTER : 0;
+  if (streamStart < limit) limit = streamStart;
+  if (looping && sample->loopEnd < limit) limit = sample->loopEnd;
+
+  uint32_t n = 0;
+  while (n < frames)
+  {
+    uint32_t pos = phase >> 32;
+    if (pos >= sample->length)
+    {
+      player->playing = false;
+      break;
+    }
+
+    if (sample->adpcm != nullptr)
+    {
+      // 展開済みのブロックの終わりまでまとめて生成する ブロックはループ終端で区切られている
+      AdpcmWindow &window = player->adpcm;
+      if (pos < window.start || pos >= window.end) window.Load(sample, pos);
+      uint32_t count = SpanCount(((uint64_t)window.end << 32) - phase, increment, incrementStep, frames - n);
+      RenderSpan<I>(window.data, window.start - INTERPOLATION_TAPS_BEFORE, phase, increment, incrementStep, gain, gainStep,
+                    player->panLeft, player->panRight, data + n * OUTPUT_CHANNELS, count);
+      n += count;
+    }
+    else if (pos >= streamStart)
+    {
+      // チャンクには前後のタップも読み込まれているので、チャンクの終わりまでまとめて生成できる
+      uint32_t chunk = (pos - streamStart) / STREAM_CHUNK;
+      uint32_t chunkStart = streamStart + chunk * STREAM_CHUNK;
+      uint32_t chunkEnd = sample->length - chunkStart > STREAM_CHUNK ? chunkStart + STREAM_CHUNK : sample->length;
+      uint32_t count = SpanCount(((uint64_t)chunkEnd << 32) - phase, increment, incrementStep, frames - n);
+      const int16_t *window = player->stream != nullptr ? player->stream->Acquire(chunk) : nullptr;
+      if (window != nullptr)
+      {
+        RenderSpan<I>(window, chunkStart - STREAM_GUARD_BEFORE, phase, increment, incrementStep, gain, gainStep,
+                      player->panLeft, player->panRight, data + n * OUTPUT_CHANNELS, count);
+      }
+      else
+      {
+        // 読み込みが間に合わなければ、その区間は無音のまま再生位置とゲインだけ進める
+        if (player->stream != nullptr) CountStreamUnderrun();
+        phase += increment * count + incrementStep * ((int64_t)count * (count - 1) / 2);
+        increment += incrementStep * count;
+        gain += gainStep * count;
+      }
+      n += count;
+    }
+    else if (pos >= INTERPOLATION_TAPS_BEFORE && pos < limit)
+    {
+      // RAMにコピーした区間に入っていれば、そちらから読む
+      const int16_t *wave = sample->sample;
+      uint32_t offset = 0;
+      uint32_t spanLimit = limit;
+      for (const SampleRegion &region : sample->regions)
+      {
+        const int16_t *cached = region.data.load(std::memory_order_acquire);
+        if (cached != nullptr && pos >= region.start + INTERPOLATION_TAPS_BEFORE && pos + INTERPOLATION_TAPS_AFTER < region.end)
+        {
+          wave = cached;
+          offset = region.start;
+          if (region.end - INTERPOLATION_TAPS_AFTER < spanLimit) spanLimit = region.end - INTERPOLATION_TAPS_AFTER;
+          break;
+        }
+      }
+      uint32_t count = SpanCount(((uint64_t)spanLimit << 32) - phase, increment, incrementStep, frames - n);
+      RenderSpan<I>(wave, offset, phase, increment, incrementStep, gain, gainStep, player->panLeft, player->panRight,
+                    data + n * OUTPUT_CHANNELS, count);
+      n += count;
+    }
+    else
+    {
+      float val = InterpolateEdge<I>(sample, phase) * gain;
+      data[n * 2] += val * player->panLeft;
+      data[n * 2 + 1] += val * player->panRight;
+      n++;
+      gain += gainStep;
+      phase += increment;
+      increment += incrementStep;
+    }
+
+    // ループポイントが設定されている場合はループする
+    if (looping && (phase >> 32) >= sample->loopEnd)
+      phase -= loopLength;
+  }
+  player->phase = phase;
+  player->phaseIncrement = increment;
+  player->gain = gain;
+}
+
+static void RenderPlayer(SamplePlayer *player, float *data, uint32_t frames)
+{
+  switch (player->sample->interpolation)
+  {
+  case InterpolationNone:
+    RenderPlayer<InterpolationNone>(player, data, frames);
+    break;
+  case InterpolationLinear:
+    RenderPlayer<InterpolationLinear>(player, data, frames);
+    break;
+  case InterpolationHermite:
+    RenderPlayer<InterpolationHermite>(player, data, frames);
+    break;
+  case InterpolationSinc:
+    RenderPlayer<InterpolationSinc>(player, data, frames);
+    break;
+  }
+}
+
+// 全Playerの波形を frames サンプル分 data に加算する
+static void RenderVoices(float *data, uint32_t frames)
+{
+  for (uint8_t i = voiceAllocator.First(), next; i != VOICE_NONE; i = next)
+  {
+    next = voiceAllocator.Next(i);
+    SamplePlayer *player = &players[i];
+    uint32_t startCycles = CycleCount();
+    RenderPlayer(player, data, frames);
+    if(player->playing == false) voiceAllocator.Free(i);
+    profiler.Record(ProfileVoice, CycleCount() - startCycles);
+  }
+
+  uint32_t startCycles = CycleCount();
+  bool ghostPlaying = false;
+  for (uint8_t i = 0; i < GHOST_SOUND; i++)
+  {
+    if (ghostRemaining[i] == 0) continue;
+    uint32_t count = frames < ghostRemaining[i] ? frames : ghostRemaining[i];
+    RenderPlayer(&ghosts[i], data, count);
+    ghostRemaining[i] = ghosts[i].playing ? ghostRemaining[i] - count : 0;
+    ghostPlaying = true;
+  }
+  if (ghostPlaying) profiler.Record(ProfileGhost, CycleCount() - startCycles);
+}
+
+void RenderBlock(float *data)
+{
+  PublishBlockClock();
+
+  // ADSR・ビブラートはブロック単位で更新し、ブロック内は直線で補間する
+  for (uint8_t c = 0; c < MIDI_CHANNELS; c++) UpdateVibrato(&channels[c]);
+  for (uint8_t i = voiceAllocator.First(); i != VOICE_NONE; i = voiceAllocator.Next(i))
+  {
+    uint32_t startCycles = CycleCount();
+    UpdateEnvelope(&players[i], SAMPLE_BUFFER_SIZE);
+    UpdatePitch(&players[i], SAMPLE_BUFFER_SIZE);
+    profiler.Record(ProfileAdsr, CycleCount() - startCycles);
+  }
+
+  // イベントの位置で波形生成を区切り、サンプル単位のタイミングで反映する
+  uint32_t n = 0;
+  const MidiEvent *event;
+  while ((event = midiQueue.Peek()) != nullptr)
+  {
+    int32_t offset = (int32_t)(event->time - blockFrame);
+    if (offset >= SAMPLE_BUFFER_SIZE) break;
+    if (offset < 0) offset = 0; // 遅れて届いたイベントはブロック先頭で処理する
+    if ((uint32_t)offset > n)
+    {
+      RenderVoices(data + n * OUTPUT_CHANNELS, offset - n);
+      n = offset;
+    }
+    MidiEvent e;
+    midiQueue.Pop(e);
+    eventOffset = n;
+    HandleMidiMessage(e.message);
+  }
+  if (n < SAMPLE_BUFFER_SIZE) RenderVoices(data + n * OUTPUT_CHANNELS, SAMPLE_BUFFER_SIZE - n);
+
+  // リリースが終わったPlayerを停止する
+  for (uint8_t i = voiceAllocator.First(), next; i != VOICE_NONE; i = next)
+  {
+    next = voiceAllocator.Next(i);
+    SamplePlayer *player = &players[i];
+    if(player->sample->adsrEnabled && player->adsrState == release && player->adsrGain == 0)
+    {
+      player->playing = false;
+      voiceAllocator.Free(i);
+    }
+  }
+  blockFrame += SAMPLE_BUFFER_SIZE;
+}
@@ -0,0 +1,181 @@
+#include "VoiceAllocator.h"
+
+#include <string.h>
+
+static_assert(MAX_SOUND < VOICE_NONE, "voice index must fit in uint8_t");
+
+VoiceAllocator voiceAllocator;
+
+VoiceAllocator::VoiceAllocator()
+{
+  for (uint8_t i = 0; i < MAX_SOUND; i++)
+  {
+    state[i] = VoiceFree;
+    activePrev[i] = VOICE_NONE;
+    activeNext[i] = i + 1 < MAX_SOUND ? i + 1 : VOICE_NONE;
+    releasedPrev[i] = releasedNext[i] = VOICE_NONE;
+  }
+  freeHead = 0;
+  memset(noteVoice, VOICE_NONE, sizeof(noteVoice));
+  for (uint8_t c = 0; c < MIDI_CHANNELS; c++)
+  {
+    channelLimit[c] = MAX_SOUND;
+    channelReserve[c] = 0;
+    channelVoices[c] = VoiceMask();
+    channelCount[c] = 0;
+  }
+}
+
+uint8_t VoiceAllocator::Allocate(uint8_t channel, uint8_t noteNo, bool *stolen)
+{
+  uint8_t voice = VOICE_NONE;
+  *stolen = false;
+  noteNo &= 0x7F;
+
+  if (policy == StealSameNote)
+  {
+    uint8_t same = noteVoice[channel][noteNo];
+    if (same != VOICE_NONE && state[same] != VoiceFree && voiceChannel[same] == channel && players[same].noteNo == noteNo)
+    {
+      voice = same;
+      *stolen = true;
+    }
+  }
+  if (voice == VOICE_NONE && freeHead != VOICE_NONE && channelCount[channel] < channelLimit[channel])
+  {
+    // 他のチャンネルの予約のうち、まだ使われていない分は空きとして使わない
+    uint8_t unused = 0;
+    for (uint8_t c = 0; c < MIDI_CHANNELS; c++)
+    {
+      if (c != channel && channelCount[c] < channelReserve[c]) unused += channelReserve[c] - channelCount[c];
+    }
+    if (MAX_SOUND - activeCount > unused)
+    {
+      voice = freeHead;
+      freeHead = activeNext[voice];
+    }
+  }
+  if (voice == VOICE_NONE)
+  {
+    voice = SelectVictim(Stealable(channel));
+    if (voice == VOICE_NONE) return VOICE_NONE;
+    *stolen = true;
+  }
+  if (state[voice] != VoiceFree)
+  {
+    // 止めるボイスは一旦空きに戻してから取り出す
+    Free(voice);
+    freeHead = activeNext[voice];
+  }
+
+  // 発音中リストの末尾(最も新しい)に加える
+  state[voice] = VoiceHeld;
+  activePrev[voice] = activeTail;
+  activeNext[voice] = VOICE_NONE;
+  if (activeTail != VOICE_NONE) activeNext[activeTail] = voice;
+  else activeHead = voice;
+  activeTail = voice;
+  activeCount++;
+
+  voiceChannel[voice] = channel;
+  channelVoices[channel].Add(voice);
+  channelCount[channel]++;
+  noteVoice[channel][noteNo] = voice;
+  return voice;
+}
+
+// channel のために止めてよいボイス
+VoiceMask VoiceAllocator::Stealable(uint8_t channel) const
+{
+  // 上限に達していれば自分のボイスから選ぶ
+  if (channelCount[channel] >= channelLimit[channel]) return channelVoices[channel];
+  VoiceMask candidates = channelVoices[channel];
+  for (uint8_t c = 0; c < MIDI_CHANNELS; c++)
+  {
+    if (channelCount[c] > channelReserve[c]) candidates |= channelVoices[c];
+  }
+  return candidates;
+}
+
+void VoiceAllocator::Release(uint8_t voice)
+{
+  if (state[voice] != VoiceHeld) return;
+  state[voice] = VoiceReleased;
+  releasedPrev[voice] = releasedTail;
+  releasedNext[voice] = VOICE_NONE;
+  if (releasedTail != VOICE_NONE) releasedNext[releasedTail] = voice;
+  else releasedHead = voice;
+  releasedTail = voice;
+}
+
+void VoiceAllocator::Free(uint8_t voice)
+{
+  if (state[voice] == VoiceFree) return;
+  Unlink(voice);
+  state[voice] = VoiceFree;
+  activePrev[voice] = VOICE_NONE;
+  activeNext[voice] = freeHead;
+  freeHead = voice;
+  activeCount--;
+  uint8_t channel = voiceChannel[voice];
+  channelVoices[channel].Remove(voice);
+  channelCount[channel]--;
+}
+
+uint8_t VoiceAllocator::SelectVictim(VoiceMask candidates) const
+{
+  if (!candidates.Any()) return VOICE_NONE;
+  switch (policy)
+  {
+  case StealQuietest:
+  {
+    uint8_t quietest = VOICE_NONE;
+    float minGain = 0.0f;
+    for (uint8_t v = activeHead; v != VOICE_NONE; v = activeNext[v])
+    {
+      if (!candidates.Has(v)) continue;
+      // ベロシティ・チャンネルの音量・エンベロープを掛けた現在のゲインで比べる ADSRの無いSampleも同じ基準になる
+      float gain = players[v].gain;
+      if (quietest == VOICE_NONE || gain < minGain)
+      {
+        minGain = gain;
+        quietest = v;
+      }
+    }
+    return quietest;
+  }
+  case StealReleasedFirst:
+    for (uint8_t v = releasedHead; v != VOICE_NONE; v = releasedNext[v])
+    {
+      if (candidates.Has(v)) return v;
+    }
+    // fall through
+  case StealOldest:
+  case StealSameNote:
+  default:
+    for (uint8_t v = activeHead; v != VOICE_NONE; v = activeNext[v])
+    {
+      if (candidates.Has(v)) return v;
+    }
+    return VOICE_NONE;
+  }
+}
+
+void VoiceAllocator::Unlink(uint8_t voice)
+{
+  if (state[voice] == VoiceReleased) UnlinkReleased(voice);
+  if (activePrev[voice] != VOICE_NONE) activeNext[activePrev[voice]] = activeNext[voice];
+  else activeHead = activeNext[voice];
+  if (activeNext[voice] != VOICE_NONE) activePrev[activeNext[voice]] = activePrev[voice];
+  else activeTail = activePrev[voice];
+  activePrev[voice] = activeNext[voice] = VOICE_NONE;
+}
+
+void VoiceAllocator::UnlinkReleased(uint8_t voice)
+{
+  if (releasedPrev[voice] != VOICE_NONE) releasedNext[releasedPrev[voice]] = releasedNext[voice];
+  else releasedHead = releasedNext[voice];
+  if (releasedNext[voice] != VOICE_NONE) releasedPrev[releasedNext[voice]] = releasedPrev[voice];
+  else releasedTail = releasedPrev[voice];
+  releasedPrev[voice] = releasedNext[voice] = VOICE_NONE;
+}
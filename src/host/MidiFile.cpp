@@ -0,0 +1,197 @@
+#include "MidiFile.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#include "MidiParser.h"
+
+namespace
+{
+  // LoadMidiStream で MidiParser のコールバックから追加する先
+  std::vector<MidiFileEvent> *streamEvents;
+  uint64_t streamFrame;
+
+  struct TrackEvent
+  {
+    uint64_t tick;
+    uint32_t tempo; // 0以外ならテンポ変更(マイクロ秒/四分音符)
+    uint8_t message[3];
+    uint8_t size;
+  };
+
+  uint32_t ReadBE(const uint8_t *p, int bytes)
+  {
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; i++) v = (v << 8) | p[i];
+    return v;
+  }
+
+  bool ReadVarLen(const uint8_t *&p, const uint8_t *end, uint32_t &value)
+  {
+    value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+      if (p >= end) return false;
+      uint8_t b = *p++;
+      value = (value << 7) | (b & 0x7F);
+      if ((b & 0x80) == 0) return true;
+    }
+    return false;
+  }
+
+  // チャンネルメッセージのデータバイト数
+  int DataLength(uint8_t status)
+  {
+    switch (status & 0xF0)
+    {
+    case 0xC0:
+    case 0xD0:
+      return 1;
+    default:
+      return 2;
+    }
+  }
+
+  bool ParseTrack(const uint8_t *p, const uint8_t *end, std::vector<TrackEvent> &out)
+  {
+    uint64_t tick = 0;
+    uint8_t runningStatus = 0;
+    while (p < end)
+    {
+      uint32_t delta;
+      if (!ReadVarLen(p, end, delta)) return false;
+      tick += delta;
+      if (p >= end) return false;
+
+      uint8_t status = *p;
+      if (status == 0xFF)
+      {
+        // メタイベント
+        if (p + 2 > end) return false;
+        uint8_t type = p[1];
+        p += 2;
+        uint32_t length;
+        if (!ReadVarLen(p, end, length) || p + length > end) return false;
+        if (type == 0x51 && length == 3)
+        {
+          TrackEvent e = {tick, ReadBE(p, 3), {0}, 0};
+          out.push_back(e);
+        }
+        p += length;
+        if (type == 0x2F) break;
+        continue;
+      }
+      if (status == 0xF0 || status == 0xF7)
+      {
+        // SysExは読み飛ばす
+        p++;
+        uint32_t length;
+        if (!ReadVarLen(p, end, length) || p + length > end) return false;
+        p += length;
+        continue;
+      }
+
+      if (status & 0x80)
+      {
+        runningStatus = status;
+        p++;
+      }
+      else if (runningStatus == 0)
+      {
+        return false;
+      }
+
+      int length = DataLength(runningStatus);
+      if (p + length > end) return false;
+      TrackEvent e = {tick, 0, {runningStatus, p[0], (uint8_t)(length > 1 ? p[1] : 0)}, (uint8_t)(length + 1)};
+      out.push_back(e);
+      p += length;
+    }
+    return true;
+  }
+}
+
+bool LoadMidiFile(const char *path, uint32_t sampleRate, std::vector<MidiFileEvent> &events)
+{
+  FILE *fp = fopen(path, "rb");
+  if (fp == nullptr) return false;
+  std::vector<uint8_t> file;
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) file.insert(file.end(), buffer, buffer + n);
+  fclose(fp);
+
+  const uint8_t *p = file.data();
+  const uint8_t *end = p + file.size();
+  if (file.size() < 14 || ReadBE(p, 4) != 0x4D546864) return false; // "MThd"
+  uint32_t headerLength = ReadBE(p + 4, 4);
+  uint16_t trackCount = ReadBE(p + 10, 2);
+  uint16_t division = ReadBE(p + 12, 2);
+  if (division & 0x8000) return false; // SMPTEタイムコードには未対応
+  p += 8 + headerLength;
+
+  std::vector<TrackEvent> merged;
+  for (uint16_t t = 0; t < trackCount && p + 8 <= end; t++)
+  {
+    uint32_t length = ReadBE(p + 4, 4);
+    const uint8_t *data = p + 8;
+    if (data + length > end) return false;
+    if (ReadBE(p, 4) == 0x4D54726B) // "MTrk"
+    {
+      std::vector<TrackEvent> track;
+      if (!ParseTrack(data, data + length, track)) return false;
+      merged.insert(merged.end(), track.begin(), track.end());
+    }
+    p = data + length;
+  }
+  std::stable_sort(merged.begin(), merged.end(), [](const TrackEvent &a, const TrackEvent &b) {
+    return a.tick < b.tick;
+  });
+
+  // テンポマップに従ってtickをサンプル位置に変換する
+  events.clear();
+  double seconds = 0.0;
+  uint64_t lastTick = 0;
+  uint32_t tempo = 500000;
+  for (const TrackEvent &e : merged)
+  {
+    seconds += (double)(e.tick - lastTick) * tempo / 1000000.0 / division;
+    lastTick = e.tick;
+    if (e.tempo != 0)
+    {
+      tempo = e.tempo;
+      continue;
+    }
+    MidiFileEvent out = {(uint64_t)(seconds * sampleRate), {e.message[0], e.message[1], e.message[2]}, e.size};
+    events.push_back(out);
+  }
+  return true;
+}
+
+bool LoadMidiStream(const char *path, uint32_t sampleRate, std::vector<MidiFileEvent> &events)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) return false;
+  std::vector<uint8_t> data;
+  uint8_t buffer[4096];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + size);
+  fclose(file);
+
+  events.clear();
+  streamEvents = &events;
+  MidiParser parser;
+  parser.onMessage = [](const uint8_t *message, uint8_t size) {
+    if (message[0] >= 0xF0) return;
+    MidiFileEvent e = {streamFrame, {message[0], message[1], size > 2 ? message[2] : (uint8_t)0}, size};
+    streamEvents->push_back(e);
+  };
+  // 1バイトはスタート・ストップビットを含めて10bit
+  for (size_t i = 0; i < data.size(); i++)
+  {
+    streamFrame = (uint64_t)(i + 1) * 10 * sampleRate / 31250;
+    parser.Parse(data[i]);
+  }
+  streamEvents = nullptr;
+  return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// ホストビルド用 Standard MIDI File(SMF)の読み込み
+struct MidiFileEvent
+{
+  uint64_t frame; // 曲頭からのサンプル位置
+  uint8_t message[3];
+  uint8_t size;
+};
+
+// フォーマット0/1のSMFを読み込み、全トラックのチャンネルメッセージを時刻順に並べて返す
+bool LoadMidiFile(const char *path, uint32_t sampleRate, std::vector<MidiFileEvent> &events);
+
+// シリアル等から記録したMIDIのバイト列を、31250bpsで途切れずに受信したものとして MidiParser で解析する
+// チャンネルメッセージだけを、最後のバイトを受信した時刻に並べて返す
+bool LoadMidiStream(const char *path, uint32_t sampleRate, std::vector<MidiFileEvent> &events);
@@ -0,0 +1,72 @@
+#include "WavWriter.h"
+
+namespace
+{
+  void Put16(uint8_t *p, uint16_t v)
+  {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+  }
+  void Put32(uint8_t *p, uint32_t v)
+  {
+    for (int i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xFF;
+  }
+}
+
+bool WavWriter::Open(const char *path, uint32_t sampleRate, uint16_t channels, bool raw)
+{
+  fp = fopen(path, "wb");
+  if (fp == nullptr) return false;
+  this->raw = raw;
+  this->channels = channels;
+  this->sampleRate = sampleRate;
+  dataBytes = 0;
+  if (!raw) WriteHeader();
+  return true;
+}
+
+void WavWriter::Write(const int16_t *data, uint32_t frames)
+{
+  if (fp == nullptr) return;
+  // WAVはリトルエンディアン
+  uint8_t buffer[512];
+  uint32_t count = frames * channels;
+  while (count > 0)
+  {
+    uint32_t n = count < sizeof(buffer) / 2 ? count : sizeof(buffer) / 2;
+    for (uint32_t i = 0; i < n; i++) Put16(buffer + i * 2, (uint16_t)data[i]);
+    fwrite(buffer, 2, n, fp);
+    data += n;
+    count -= n;
+    dataBytes += n * 2;
+  }
+}
+
+void WavWriter::Close()
+{
+  if (fp == nullptr) return;
+  if (!raw)
+  {
+    fseek(fp, 0, SEEK_SET);
+    WriteHeader();
+  }
+  fclose(fp);
+  fp = nullptr;
+}
+
+void WavWriter::WriteHeader()
+{
+  uint8_t header[44] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+                        'f', 'm', 't', ' ', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                        'd', 'a', 't', 'a', 0, 0, 0, 0};
+  Put32(header + 4, 36 + dataBytes);
+  Put32(header + 16, 16);
+  Put16(header + 20, 1); // PCM
+  Put16(header + 22, channels);
+  Put32(header + 24, sampleRate);
+  Put32(header + 28, sampleRate * channels * 2);
+  Put16(header + 32, channels * 2);
+  Put16(header + 34, 16);
+  Put32(header + 40, dataBytes);
+  fwrite(header, 1, sizeof(header), fp);
+}
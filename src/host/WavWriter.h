@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// ホストビルド用 I2Sの代わりにPCMをファイルへ書き出す
+class WavWriter
+{
+public:
+  // raw == true の場合はヘッダ無しのPCMを書き出す
+  bool Open(const char *path, uint32_t sampleRate, uint16_t channels, bool raw);
+  void Write(const int16_t *data, uint32_t frames);
+  void Close();
+
+private:
+  FILE *fp = nullptr;
+  bool raw = false;
+  uint16_t channels = 1;
+  uint32_t dataBytes = 0;
+  uint32_t sampleRate = 0;
+
+  void WriteHeader();
+};
@@ -0,0 +1,255 @@
+// ホスト(native)ビルド用のオフラインレンダラ
+// MIDIファイルを実時間より速くWAVに書き出し、1ブロックあたりの処理時間を計測する
+// pio test ではテストの main() を使うので除く
+
+#ifndef PIO_UNIT_TESTING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "Sampler.h"
+#include "Profiler.h"
+#include "OutputStage.h"
+#include "Limiter.h"
+#include "VoiceAllocator.h"
+#include "SampleStream.h"
+#include "SampleBank.h"
+#include "SampleCache.h"
+#include "MidiFile.h"
+#include "WavWriter.h"
+
+extern const int16_t piano_sample[128000];
+
+#define STREAM_RESIDENT_LENGTH 32768 // ストリーミング時にメモリから再生する先頭のサンプル数
+
+namespace
+{
+  void PrintUsage(const char *name)
+  {
+    fprintf(stderr,
+            "usage: %s [options] input.mid output.wav\n"
+            "  --raw          ヘッダ無しの16bit PCMを書き出す\n"
+            "  --midi-stream  入力をSMFではなく、記録したMIDIのバイト列として読み込む\n"
+            "  --tail <sec>   最後のイベントの後に描画する秒数 (default: 3)\n"
+            "  --interp <none|linear|hermite|sinc>  補間方法を指定する\n"
+            "  --steal <oldest|quietest|released|samenote>  発音数が足りない時に止めるボイスの選び方\n"
+            "  --channel-limit <ch>:<voices>[:<reserved>]  チャンネル(1〜16)の最大発音数と予約数\n"
+            "  --soft-clip    int16変換時にソフトクリップする\n"
+            "  --dither       int16変換時に三角分布ディザを加える\n"
+            "  --no-limiter   リミッタを無効にする\n"
+            "  --volume <v>   masterVolume (default: 0.5)\n"
+            "  --bank <file>  サンプルバンクをマップして内蔵のピアノの代わりに使う\n"
+            "  --cache <KB>   発音開始部分とループ区間をRAMにコピーするキャッシュの容量\n"
+            "  --pin          発音開始部分とループ区間を起動時にRAMにコピーしておく\n"
+            "  --stream <file>  先頭以外をファイルからストリーミング再生する (無ければ書き出す)\n"
+            "  --stream-interval <blocks>  読み込みタスクを動かす間隔 (default: 1)\n",
+            name);
+  }
+
+  // ストリーミング用のファイルが無ければ piano_sample を書き出してから開く
+  bool PrepareStream(const char *path, SampleStream *stream)
+  {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+      if ((file = fopen(path, "wb")) == nullptr) return false;
+      fwrite(piano_sample, sizeof(piano_sample[0]), piano.length, file);
+    }
+    fclose(file);
+    return OpenSampleStream(stream, path, 0);
+  }
+
+  int FindName(const char **names, const char *name)
+  {
+    for (int i = 0; names[i] != nullptr; i++)
+    {
+      if (strcmp(names[i], name) == 0) return i;
+    }
+    return -1;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const char *inputPath = nullptr;
+  const char *outputPath = nullptr;
+  bool raw = false;
+  bool midiStream = false;
+  float tailSeconds = 3.0f;
+  const char *interpolation = nullptr;
+  const char *steal = nullptr;
+  const char *streamPath = nullptr;
+  const char *bankPath = nullptr;
+  bool pin = false;
+  uint32_t streamInterval = 1;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--raw") == 0) raw = true;
+    else if (strcmp(argv[i], "--midi-stream") == 0) midiStream = true;
+    else if (strcmp(argv[i], "--tail") == 0 && i + 1 < argc) tailSeconds = atof(argv[++i]);
+    else if (strcmp(argv[i], "--interp") == 0 && i + 1 < argc) interpolation = argv[++i];
+    else if (strcmp(argv[i], "--steal") == 0 && i + 1 < argc) steal = argv[++i];
+    else if (strcmp(argv[i], "--channel-limit") == 0 && i + 1 < argc)
+    {
+      unsigned channel, limit, reserve = 0;
+      if (sscanf(argv[++i], "%u:%u:%u", &channel, &limit, &reserve) < 2 || channel < 1 || channel > MIDI_CHANNELS)
+      {
+        PrintUsage(argv[0]);
+        return 1;
+      }
+      voiceAllocator.channelLimit[channel - 1] = limit;
+      voiceAllocator.channelReserve[channel - 1] = reserve;
+    }
+    else if (strcmp(argv[i], "--soft-clip") == 0) outputClip = ClipSoft;
+    else if (strcmp(argv[i], "--dither") == 0) outputDither = true;
+    else if (strcmp(argv[i], "--no-limiter") == 0) limiter.enabled = false;
+    else if (strcmp(argv[i], "--volume") == 0 && i + 1 < argc) masterVolume = atof(argv[++i]);
+    else if (strcmp(argv[i], "--bank") == 0 && i + 1 < argc) bankPath = argv[++i];
+    else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) sampleCache.capacity = atoi(argv[++i]) * 1024;
+    else if (strcmp(argv[i], "--pin") == 0) pin = true;
+    else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) streamPath = argv[++i];
+    else if (strcmp(argv[i], "--stream-interval") == 0 && i + 1 < argc) streamInterval = atoi(argv[++i]);
+    else if (argv[i][0] == '-')
+    {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+    else if (inputPath == nullptr) inputPath = argv[i];
+    else if (outputPath == nullptr) outputPath = argv[i];
+  }
+  if (inputPath == nullptr || outputPath == nullptr)
+  {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  std::vector<MidiFileEvent> events;
+  bool loaded = midiStream ? LoadMidiStream(inputPath, SAMPLE_RATE, events) : LoadMidiFile(inputPath, SAMPLE_RATE, events);
+  if (!loaded)
+  {
+    fprintf(stderr, "failed to load %s\n", inputPath);
+    return 1;
+  }
+  WavWriter writer;
+  if (!writer.Open(outputPath, SAMPLE_RATE, OUTPUT_CHANNELS, raw))
+  {
+    fprintf(stderr, "failed to open %s\n", outputPath);
+    return 1;
+  }
+
+  InitSampler();
+
+  static SampleBank bank;
+  if (bankPath != nullptr)
+  {
+    if (!MapSampleBank(&bank, bankPath))
+    {
+      fprintf(stderr, "failed to load bank %s\n", bankPath);
+      return 1;
+    }
+    SetInstrument(&bank.instrument);
+  }
+
+  static const char *interpolationNames[] = {"none", "linear", "hermite", "sinc", nullptr};
+  static const char *stealNames[] = {"oldest", "quietest", "released", "samenote", nullptr};
+  int index;
+  if (interpolation != nullptr)
+  {
+    if ((index = FindName(interpolationNames, interpolation)) < 0)
+    {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+    piano.interpolation = (SampleInterpolation)index;
+    for (uint8_t i = 0; i < bank.sampleCount; i++) bank.samples[i].interpolation = (SampleInterpolation)index;
+  }
+  if (steal != nullptr)
+  {
+    if ((index = FindName(stealNames, steal)) < 0)
+    {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+    voiceAllocator.policy = (VoiceStealPolicy)index;
+  }
+
+  static SampleStream stream;
+  if (streamPath != nullptr)
+  {
+    if (!PrepareStream(streamPath, &stream))
+    {
+      fprintf(stderr, "failed to open %s\n", streamPath);
+      return 1;
+    }
+    piano.stream = &stream;
+    piano.residentLength = STREAM_RESIDENT_LENGTH;
+    InitSampleCache(&piano);
+    if (streamInterval == 0) streamInterval = 1;
+  }
+
+  if (pin)
+  {
+    Instrument *instrument = bankPath != nullptr ? &bank.instrument : &pianoInstrument;
+    for (uint8_t i = 0; i < instrument->zoneCount; i++) sampleCache.Pin(instrument->zones[i].sample);
+  }
+
+  uint64_t lastFrame = events.empty() ? 0 : events.back().frame;
+  uint64_t totalFrames = lastFrame + (uint64_t)(tailSeconds * SAMPLE_RATE);
+  uint64_t blockCount = (totalFrames + SAMPLE_BUFFER_SIZE - 1) / SAMPLE_BUFFER_SIZE;
+
+  size_t nextEvent = 0;
+  uint64_t totalCycles = 0;
+  // 全てのイベントを送り終えるまでは描画を続ける
+  uint64_t block = 0;
+  for (; block < blockCount || nextEvent < events.size(); block++)
+  {
+    uint64_t blockEnd = (block + 1) * SAMPLE_BUFFER_SIZE;
+    // RenderBlock はブロック内のイベントを全て取り出すので、ここでは毎回キューが空になっている
+    // キューに入りきらない分は次のブロックに回し、ブロック先頭で遅れて処理させる
+    for (uint32_t posted = 0; posted < MIDI_QUEUE_SIZE && nextEvent < events.size() && events[nextEvent].frame < blockEnd; posted++)
+    {
+      const uint8_t *message = events[nextEvent].message;
+      if (!PostMidiMessageAt((uint32_t)events[nextEvent].frame, message[0], message[1], message[2])) break;
+      nextEvent++;
+    }
+
+    // 実機では別タスクで動く読み込みを、ブロックの合間に行う
+    if (streamPath != nullptr && block % streamInterval == 0) ServiceSampleStreams();
+    sampleCache.Service();
+
+    uint32_t startCycles = CycleCount();
+
+    float data[SAMPLE_BUFFER_SIZE * OUTPUT_CHANNELS] = {0.0f};
+    RenderBlock(data);
+    int16_t dataI[SAMPLE_BUFFER_SIZE * OUTPUT_CHANNELS];
+    limiter.Process(data);
+    ConvertOutput(data, dataI);
+
+    uint32_t cycles = CycleCount() - startCycles;
+    profiler.Record(ProfileBlock, cycles);
+    profiler.Collect();
+    totalCycles += cycles;
+
+    writer.Write(dataI, SAMPLE_BUFFER_SIZE);
+  }
+  writer.Close();
+
+  blockCount = block;
+  double seconds = (double)blockCount * SAMPLE_BUFFER_SIZE / SAMPLE_RATE;
+  double processSeconds = (double)totalCycles / CyclesPerMicrosecond() / 1e6;
+  fprintf(stderr, "rendered %.2f s (%llu blocks, %zu events), budget %u us/block, %.1fx realtime\n",
+          seconds, (unsigned long long)blockCount, events.size(), AUDIO_LOOP_INTERVAL,
+          processSeconds > 0 ? seconds / processSeconds : 0.0);
+  if (sampleCache.capacity > 0 || sampleCache.Pinned() > 0)
+    fprintf(stderr, "cache hits: %u, misses: %u, used: %u bytes, pinned: %u bytes\n",
+            sampleCache.Hits(), sampleCache.Misses(), sampleCache.Used(), sampleCache.Pinned());
+  if (streamPath != nullptr) fprintf(stderr, "stream underruns: %u\n", StreamUnderruns());
+  fprintf(stderr, "midi queue dropped: %u\n", midiQueue.Dropped());
+  profiler.Dump([](const char *line) { fprintf(stderr, "%s\n", line); });
+  return 0;
+}
+
+#endif
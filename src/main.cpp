@@ -1,6 +1,13 @@
 #include <M5Unified.h>
 #include <driver/i2s.h>
 #include <ml_reverb.h>
+#include "Sampler.h"
+#include "Profiler.h"
+#include "OutputStage.h"
+#include "Limiter.h"
+#include "SampleBank.h"
+#include "SampleCache.h"
+#include "MidiParser.h"
 
 extern const int16_t piano_sample[128000];
 
@@ -15,133 +22,56 @@ extern const int16_t piano_sample[128000];
 #define MODE_SPK 1
 #define DATA_SIZE 1024
 
-#define SAMPLE_BUFFER_SIZE 64
-#define SAMPLE_RATE 44100
-constexpr uint32_t AUDIO_LOOP_INTERVAL = (uint32_t)(SAMPLE_BUFFER_SIZE * 1000000 / SAMPLE_RATE);// micro seconds
-
-#define MAX_SOUND 12 // 最大同時発音数
-
-float masterVolume = 0.5f;
-
-unsigned long nextAudioLoop = 0;
-uint32_t audioProcessTime = 0; // プロファイリング用 一回のオーディオ処理にかかる時間
-
-enum SampleAdsr
+// プロファイル結果をシリアルに出力する間隔(ms) 0で無効
+// 出力はMIDI入力と同じUARTを塞ぐので、測定する時だけ -DPROFILER_DUMP_INTERVAL=5000 等で有効にする
+#ifndef PROFILER_DUMP_INTERVAL
+#define PROFILER_DUMP_INTERVAL 0
+#endif
+#define SAMPLE_CACHE_BYTES (2 * 1024 * 1024) // PSRAMがある場合にサンプルのキャッシュに使う容量
+// 定義すると、起動時に内部RAMへのコピーの効果を測ってシリアルに出力する
+// #define SAMPLE_READ_BENCHMARK
+#define SAMPLE_BANK_PARTITION "samples" // サンプルバンクを書き込むパーティションのラベル (partitions.csv)
+
+static SampleBank bank;
+
+// SDカード上の波形をストリーミング再生する場合に定義する (例: -DSAMPLE_STREAM_PATH=\"/sd/piano.raw\")
+// ファイルは piano_sample と同じ内容のヘッダ無し16bit PCM
+#ifdef SAMPLE_STREAM_PATH
+#include <SD.h>
+#include "SampleStream.h"
+#define SAMPLE_RESIDENT_LENGTH 32768 // メモリに残す先頭のサンプル数 ループ区間を含むこと
+#define SD_CS_PIN 4
+
+static SampleStream pianoStream;
+
+// 各ボイスの次のチャンクをSDカードから読み込む
+void StreamLoop(void *pvParameters)
 {
-  attack,
-  decay,
-  sustain,
-  release,
-};
-
-struct Sample
-{
-  const int16_t *sample;
-  uint32_t length;
-  uint8_t root;
-  uint32_t loopStart;
-  uint32_t loopEnd;
-
-  bool adsrEnabled;
-  float attack;
-  float decay;
-  float sustain;
-  float release;
-};
-
-struct SamplePlayer
-{
-  SamplePlayer(struct Sample *sample, uint8_t noteNo, float volume)
-    : sample{sample}, noteNo{noteNo}, volume{volume}, createdAt{micros()} {}
-  SamplePlayer() : sample{nullptr}, noteNo{60}, volume{1.0f}, playing{false}, createdAt{micros()} {}
-  struct Sample *sample;
-  uint8_t noteNo;
-  float pitchBend = 0;
-  float volume;
-  unsigned long createdAt = 0;
-  uint32_t pos = 0;
-  float pos_f = 0.0f;
-  bool playing = true;
-  bool released = false;
-  float adsrGain = 0.0f;
-  enum SampleAdsr adsrState = SampleAdsr::attack;
-};
-
-struct Sample piano = Sample{
-    piano_sample,
-    128000,
-    60,
-    24120,
-    24288,
-    true,
-    1.0f,
-    0.998887f,
-    0.1f,
-    0.988885f};
-
-SamplePlayer players[MAX_SOUND] = {SamplePlayer()};
-
-inline float PitchFromNoteNo(float noteNo, float root)
-{
-    float delta = noteNo - root;
-    float f = ((pow(2.0f, delta / 12.0f)));
-    return f;
-}
-
-inline void UpdateAdsr(SamplePlayer *player)
-{
-  Sample *sample = player->sample;
-  if(player->released) player->adsrState = release;
-
-  switch (player->adsrState)
+  while (true)
   {
-  case attack:
-    player->adsrGain += sample->attack;
-    if (player->adsrGain >= 1.0f)
-    {
-      player->adsrGain = 1.0f;
-      player->adsrState = decay;
-    }
-    break;
-  case decay:
-    player->adsrGain = (player->adsrGain - sample->sustain) * sample->decay + sample->sustain;
-    if ((player->adsrGain - sample->sustain) < 0.01f)
-    {
-      player->adsrState = sustain;
-      player->adsrGain = sample->sustain;
-    }
-    break;
-  case sustain:
-    break;
-  case release:
-    player->adsrGain *= sample->release;
-    if (player->adsrGain < 0.01f)
-    {
-      player->adsrGain = 0;
-      player->playing = false;
-    }
-    break;
+    ServiceSampleStreams();
+    vTaskDelay(1);
   }
 }
+#endif
+
+unsigned long nextAudioLoop = 0;
 
-void SendNoteOn(uint8_t noteNo, uint8_t velocity, uint8_t channnel) {
-  uint8_t oldestPlayerId = 0;
-  for(uint8_t i = 0;i < MAX_SOUND;i++) {
-    if(players[i].playing == false) {
-      players[i] = SamplePlayer(&piano, noteNo, velocity / 127.0f);
-      return;
-    } else {
-      if(players[i].createdAt < players[oldestPlayerId].createdAt) oldestPlayerId = i;
-    }
+// Reverb_Process はモノラルなので、ミッド成分 (L+R)/2 にかけてサイド成分 (L-R)/2 は素通しする
+void ProcessReverb(float *data)
+{
+  float mid[SAMPLE_BUFFER_SIZE];
+  float side[SAMPLE_BUFFER_SIZE];
+  for (uint8_t i = 0; i < SAMPLE_BUFFER_SIZE; i++)
+  {
+    mid[i] = (data[i * 2] + data[i * 2 + 1]) * 0.5f;
+    side[i] = (data[i * 2] - data[i * 2 + 1]) * 0.5f;
   }
-  // 全てのPlayerが再生中だった時には、最も昔に発音されたPlayerを停止する
-  players[oldestPlayerId] = SamplePlayer(&piano, noteNo, velocity / 127.0f);
-}
-void SendNoteOff(uint8_t noteNo,  uint8_t velocity, uint8_t channnel) {
-  for(uint8_t i = 0;i < MAX_SOUND;i++) {
-    if(players[i].playing == true && players[i].noteNo == noteNo) {
-      players[i].released = true;
-    }
+  Reverb_Process(mid, SAMPLE_BUFFER_SIZE);
+  for (uint8_t i = 0; i < SAMPLE_BUFFER_SIZE; i++)
+  {
+    data[i * 2] = mid[i] + side[i];
+    data[i * 2 + 1] = mid[i] - side[i];
   }
 }
 
@@ -149,63 +79,27 @@ void AudioLoop(void *pvParameters)
 {
   while (true)
   {
-    float data[SAMPLE_BUFFER_SIZE] = {0.0f};
+    float data[SAMPLE_BUFFER_SIZE * OUTPUT_CHANNELS] = {0.0f};
 
-    unsigned long startTime = micros();
+    uint32_t startCycles = CycleCount();
 
     // 波形を生成
-    for (uint8_t i = 0; i < MAX_SOUND; i++)
-    {
-      SamplePlayer *player = &players[i];
-      if(player->playing == false) continue;
-      Sample *sample = player->sample;
-      if(sample->adsrEnabled) UpdateAdsr(player);
-      if(player->playing == false) continue;
-
-      float pitch = PitchFromNoteNo(player->noteNo, player->sample->root);
-
-      for (int n = 0; n < SAMPLE_BUFFER_SIZE; n++)
-      {
-        if (player->pos >= sample->length)
-        {
-          player->playing = false;
-          break;
-        }
-        else
-        {
-          // 波形を読み込む
-          float val = sample->sample[player->pos];
-          if(sample->adsrEnabled) val *= player->adsrGain;
-          val *= player->volume;
-          data[n] += val;
-
-          // 次のサンプルへ移動
-          int32_t pitch_u = pitch;
-          player->pos_f += pitch - pitch_u;
-          player->pos += pitch_u;
-          int posI = player->pos_f;
-          player->pos += posI;
-          player->pos_f -= posI;
-
-          // ループポイントが設定されている場合はループする
-          if(sample->adsrEnabled && player->released == false && player->pos >= sample->loopEnd)
-            player->pos -= (sample->loopEnd - sample->loopStart);
-        }
-      }
-    }
-
-    Reverb_Process(data, SAMPLE_BUFFER_SIZE);
-
-    int16_t dataI[SAMPLE_BUFFER_SIZE];
-    for (uint8_t i = 0; i < SAMPLE_BUFFER_SIZE; i++) {
-      dataI[i] = int16_t(data[i] * masterVolume);
-    }
-
-    unsigned long endTime = micros();
-    audioProcessTime = endTime - startTime;
+    RenderBlock(data);
+
+    uint32_t reverbCycles = CycleCount();
+    ProcessReverb(data);
+    profiler.Record(ProfileReverb, CycleCount() - reverbCycles);
+
+    int16_t dataI[SAMPLE_BUFFER_SIZE * OUTPUT_CHANNELS];
+    limiter.Process(data);
+    ConvertOutput(data, dataI);
+
+    uint32_t endCycles = CycleCount();
+    profiler.Record(ProfileBlock, endCycles - startCycles);
 
     static size_t bytes_written = 0;
-    i2s_write(Speak_I2S_NUMBER, (const unsigned char *)dataI, 2 * SAMPLE_BUFFER_SIZE, &bytes_written, portMAX_DELAY);
+    i2s_write(Speak_I2S_NUMBER, (const unsigned char *)dataI, sizeof(dataI), &bytes_written, portMAX_DELAY);
+    profiler.Record(ProfileI2sWrite, CycleCount() - endCycles);
   }
 }
 
@@ -218,7 +112,7 @@ bool InitI2SSpeakOrMic(int mode)
       .mode = (i2s_mode_t)(I2S_MODE_MASTER),
       .sample_rate = SAMPLE_RATE,
       .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
-      .channel_format = I2S_CHANNEL_FMT_ONLY_RIGHT,
+      .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
       .communication_format = I2S_COMM_FORMAT_I2S,
       .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
       .dma_buf_count = 8,
@@ -246,22 +140,62 @@ bool InitI2SSpeakOrMic(int mode)
   return true;
 }
 
-// 動作確認用機能のため、CH1のみに対応
-void HandleMidiMessage(uint8_t *message)
+#ifdef SAMPLE_READ_BENCHMARK
+#define BENCHMARK_BLOCKS 512
+
+// 和音をサステインさせて1ブロックの処理時間を測る
+// loop() や画面描画がフラッシュのキャッシュを使う代わりに、毎ブロック前に波形の後半を読んでキャッシュを追い出す
+static void MeasureSustain(const char *label)
 {
-  if (message[0] == 0x90)
+  static const uint8_t notes[] = {48, 52, 55, 60, 64, 67, 72, 76};
+  for (uint8_t note : notes) PostMidiMessageAt(CurrentFrame(), 0x90, note, 100);
+
+  uint64_t total = 0;
+  uint32_t worst = 0;
+  volatile int32_t sink = 0;
+  for (uint32_t block = 0; block < BENCHMARK_BLOCKS; block++)
   {
-    SendNoteOn(message[1], message[2], 1);
+    for (uint32_t i = 0; i < 32768; i += 16) sink += piano_sample[64000 + i];
+    float data[SAMPLE_BUFFER_SIZE * OUTPUT_CHANNELS] = {0.0f};
+    uint32_t startCycles = CycleCount();
+    RenderBlock(data);
+    uint32_t cycles = CycleCount() - startCycles;
+    // 発音開始部分を過ぎてループに入ってから数える
+    if (block < BENCHMARK_BLOCKS / 2) continue;
+    total += cycles;
+    if (cycles > worst) worst = cycles;
   }
-  else if (message[0] == 0x80)
+  Serial.printf("%s: avg %u us, max %u us per block\n", label,
+                (unsigned)(total / (BENCHMARK_BLOCKS / 2) / CyclesPerMicrosecond()), (unsigned)(worst / CyclesPerMicrosecond()));
+
+  for (uint8_t note : notes) PostMidiMessageAt(CurrentFrame(), 0x80, note, 0);
+  for (uint32_t block = 0; block < BENCHMARK_BLOCKS * 2; block++)
   {
-    SendNoteOff(message[1], message[2], 1);
+    float data[SAMPLE_BUFFER_SIZE * OUTPUT_CHANNELS] = {0.0f};
+    RenderBlock(data);
   }
 }
 
+// 内部RAMへのコピーの有無で比べる
+static void BenchmarkSampleRead(Instrument *instrument)
+{
+  MeasureSustain("flash");
+  for (uint8_t i = 0; i < instrument->zoneCount; i++) sampleCache.Pin(instrument->zones[i].sample);
+  MeasureSustain("internal RAM");
+}
+#endif
+
+// チャンネルメッセージだけをオーディオタスクに送る
+static MidiParser midiParser;
+static void OnMidiMessage(const uint8_t *message, uint8_t size)
+{
+  if (message[0] < 0xF0) PostMidiMessage(message[0], message[1], size > 2 ? message[2] : 0);
+}
+
 void setup()
 {
   M5.begin();
+  midiParser.onMessage = OnMidiMessage;
   M5.Display.startWrite();
   M5.Display.fillScreen(WHITE);
   M5.Display.setTextColor(BLACK);
@@ -279,12 +213,45 @@ void setup()
   M5.Display.setCursor(64, 216);
   M5.Display.printf("Do     Mi     So");
   M5.Display.endWrite();
+  InitSampler();
+  // パーティションにサンプルバンクが書き込まれていれば、内蔵のピアノの代わりに使う
+  Instrument *instrument = MapSampleBank(&bank, SAMPLE_BANK_PARTITION) ? &bank.instrument : &pianoInstrument;
+  SetInstrument(instrument);
+#ifdef SAMPLE_READ_BENCHMARK
+  BenchmarkSampleRead(instrument);
+#endif
+  // 発音開始部分とループ区間は内部RAMに置く 入りきらない分はPSRAMのキャッシュに任せる
+  for (uint8_t i = 0; i < instrument->zoneCount; i++) sampleCache.Pin(instrument->zones[i].sample);
+  if (psramFound()) sampleCache.capacity = SAMPLE_CACHE_BYTES;
   InitI2SSpeakOrMic(MODE_SPK);
 
+  // 起動音 モノラルの波形を両chに複製して書き込む
   size_t bytes_written = 0;
-  i2s_write(Speak_I2S_NUMBER, (const unsigned char *)piano_sample, 256000, &bytes_written, portMAX_DELAY);
+  for (uint32_t pos = 0; pos < 128000; pos += SAMPLE_BUFFER_SIZE)
+  {
+    int16_t stereo[SAMPLE_BUFFER_SIZE * 2];
+    for (uint8_t i = 0; i < SAMPLE_BUFFER_SIZE; i++) stereo[i * 2] = stereo[i * 2 + 1] = piano_sample[pos + i];
+    i2s_write(Speak_I2S_NUMBER, (const unsigned char *)stereo, sizeof(stereo), &bytes_written, portMAX_DELAY);
+  }
   delay(100);
 
+#ifdef SAMPLE_STREAM_PATH
+  if (SD.begin(SD_CS_PIN, SPI, 25000000) && OpenSampleStream(&pianoStream, SAMPLE_STREAM_PATH, 0))
+  {
+    piano.stream = &pianoStream;
+    piano.residentLength = SAMPLE_RESIDENT_LENGTH;
+    // Core1で、loop() より優先して読み込む
+    xTaskCreateUniversal(
+        StreamLoop,
+        "streamLoop",
+        4096,
+        NULL,
+        2,
+        NULL,
+        1);
+  }
+#endif
+
   static float revBuffer[REV_BUFF_SIZE];
   Reverb_Setup(revBuffer);
   Reverb_SetLevel(0, 0.2f);
@@ -304,53 +271,58 @@ void setup()
 
 void loop()
 {
-  // シリアルポートから受信したMIDIを再生
-  static uint8_t message[3] = {0x00};
-  while (Serial.available() > 0)
+  // シリアルポートから受信したMIDIを、受信バッファにある分まとめて解析して再生
+  uint8_t buffer[64];
+  int available;
+  while ((available = Serial.available()) > 0)
   {
-    uint8_t byte = Serial.read();
-    if(message[0] != 0x00) {
-      if(message[1] == 0x00) message[1] = byte;
-      else if(message[2] == 0x00) {
-        message[2] = byte;
-        HandleMidiMessage(message);
-        message[0] = 0x00;
-        message[1] = 0x00;
-        message[2] = 0x00;
-      }
-    }
-    else if (byte == 0x90 || byte == 0x80)
-    {
-      message[0] = byte;
-    }
+    size_t size = Serial.readBytes(buffer, available < (int)sizeof(buffer) ? available : sizeof(buffer));
+    midiParser.Parse(buffer, size);
   }
 
   // 本体ボタンタッチで単音を再生
   M5.update();
   if(M5.BtnA.wasPressed()) {
-    SendNoteOn(60, 100, 1);
+    PostMidiMessage(0x90, 60, 100);
   }
   else if(M5.BtnA.wasReleased()) {
-    SendNoteOff(60, 100, 1);
+    PostMidiMessage(0x80, 60, 100);
   }
   if(M5.BtnB.wasPressed()) {
-    SendNoteOn(64, 100, 1);
+    PostMidiMessage(0x90, 64, 100);
   }
   else if(M5.BtnB.wasReleased()) {
-    SendNoteOff(64, 100, 1);
+    PostMidiMessage(0x80, 64, 100);
   }
     if(M5.BtnC.wasPressed()) {
-    SendNoteOn(67, 100, 1);
+    PostMidiMessage(0x90, 67, 100);
   }
   else if(M5.BtnC.wasReleased()) {
-    SendNoteOff(67, 100, 1);
+    PostMidiMessage(0x80, 67, 100);
   }
 
+  // プロファイル結果を集計し、一定間隔でシリアルに出力
+  profiler.Collect();
+#if PROFILER_DUMP_INTERVAL > 0
+  static unsigned long lastDump = 0;
+  if (millis() - lastDump >= PROFILER_DUMP_INTERVAL)
+  {
+    lastDump = millis();
+    profiler.Dump([](const char *line) { Serial.println(line); });
+    Serial.printf("midi queue dropped: %u\n", midiQueue.Dropped());
+    if (sampleCache.capacity > 0)
+      Serial.printf("cache hits: %u, misses: %u, used: %u bytes\n", sampleCache.Hits(), sampleCache.Misses(), sampleCache.Used());
+  }
+#endif
+
+  // ノートオンされたSampleをキャッシュに載せる
+  sampleCache.Service();
+
   // オーディオ負荷率を出力
   M5.Display.startWrite();
   M5.Display.fillRect(10,96,310,16,WHITE);
   M5.Display.drawRect(10,96,240,16,BLACK);
-  float audioLoad = (float)audioProcessTime / AUDIO_LOOP_INTERVAL;
+  float audioLoad = (float)profiler.GetStats(ProfileBlock).latest / CyclesPerMicrosecond() / AUDIO_LOOP_INTERVAL;
   M5.Display.fillRect(10,96,audioLoad * 240,16,BLUE);
   M5.Display.endWrite();
 
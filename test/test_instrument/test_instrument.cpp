@@ -0,0 +1,59 @@
+// ゾーン表のホスト用テスト pio test -e native
+#include <unity.h>
+
+#include "Instrument.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// 16の倍数でない境界でも、ゾーンの範囲通りに選ぶ
+void test_velocity_boundary(void)
+{
+  static const SampleZone zones[] = {
+      {&piano, 0, 127, 0, 99},
+      {&piano, 0, 127, 100, 127},
+  };
+  static Instrument instrument = {zones, 2};
+  TEST_ASSERT_TRUE(InitInstrument(&instrument));
+  for (int velocity = 0; velocity < 128; velocity++)
+  {
+    uint8_t expected = velocity < 100 ? 0 : 1;
+    TEST_ASSERT_EQUAL_UINT8(expected, instrument.zoneTable[60][instrument.velocityLayers[velocity]]);
+  }
+}
+
+// どのゾーンにも含まれない鍵・ベロシティは最も近いゾーンを使う
+void test_nearest_zone(void)
+{
+  static const SampleZone zones[] = {
+      {&piano, 40, 80, 1, 40},
+      {&piano, 40, 80, 90, 127},
+  };
+  static Instrument instrument = {zones, 2};
+  TEST_ASSERT_TRUE(InitInstrument(&instrument));
+  TEST_ASSERT_EQUAL_UINT8(0, instrument.zoneTable[60][instrument.velocityLayers[0]]);
+  TEST_ASSERT_EQUAL_UINT8(0, instrument.zoneTable[60][instrument.velocityLayers[65]]);
+  TEST_ASSERT_EQUAL_UINT8(1, instrument.zoneTable[60][instrument.velocityLayers[66]]);
+  TEST_ASSERT_EQUAL_UINT8(1, instrument.zoneTable[20][instrument.velocityLayers[127]]);
+  TEST_ASSERT_EQUAL_UINT8(0, instrument.zoneTable[100][instrument.velocityLayers[10]]);
+}
+
+// ベロシティの区間が ZONE_VELOCITY_LAYERS を超える楽器は作れない
+void test_too_many_layers(void)
+{
+  static SampleZone zones[ZONE_VELOCITY_LAYERS + 1];
+  for (int i = 0; i <= ZONE_VELOCITY_LAYERS; i++) zones[i] = {&piano, 0, 127, (uint8_t)(i * 7), (uint8_t)(i * 7 + 6)};
+  static Instrument instrument = {zones, ZONE_VELOCITY_LAYERS + 1};
+  TEST_ASSERT_FALSE(InitInstrument(&instrument));
+  instrument.zoneCount = ZONE_VELOCITY_LAYERS;
+  TEST_ASSERT_TRUE(InitInstrument(&instrument));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_velocity_boundary);
+  RUN_TEST(test_nearest_zone);
+  RUN_TEST(test_too_many_layers);
+  return UNITY_END();
+}
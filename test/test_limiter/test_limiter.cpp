@@ -0,0 +1,71 @@
+// リミッタのホスト用テスト pio test -e native
+#include <unity.h>
+#include <stdlib.h>
+
+#include "Limiter.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// 直近 LIMITER_LOOKAHEAD 個を毎回数え直した最小値と比べる
+static void CheckAgainstNaive(float (*generate)(uint32_t), uint32_t count)
+{
+  static SlidingMinimum window;
+  window = SlidingMinimum();
+  static float history[1 << 16];
+  for (uint32_t i = 0; i < count; i++)
+  {
+    history[i] = generate(i);
+    float expected = history[i];
+    for (uint32_t k = i >= LIMITER_LOOKAHEAD - 1 ? i - (LIMITER_LOOKAHEAD - 1) : 0; k < i; k++)
+      if (history[k] < expected) expected = history[k];
+    TEST_ASSERT_EQUAL_FLOAT(expected, window.Push(history[i]));
+  }
+}
+
+static float Random(uint32_t) { return rand() / (float)RAND_MAX; }
+// 単調増加の区間が区間長より長く続くと、取り除かれずに溜まる値が最も多くなる
+static float Rising(uint32_t i) { return (i % 100) / 100.0f; }
+static float Falling(uint32_t i) { return 1.0f - (i % 100) / 100.0f; }
+static float Steps(uint32_t i) { return ((i / 7) % 5) * 0.25f; }
+
+void test_sliding_minimum_random(void) { srand(1); CheckAgainstNaive(Random, 1 << 16); }
+void test_sliding_minimum_rising(void) { CheckAgainstNaive(Rising, 1 << 16); }
+void test_sliding_minimum_falling(void) { CheckAgainstNaive(Falling, 1 << 16); }
+void test_sliding_minimum_repeated_values(void) { CheckAgainstNaive(Steps, 1 << 16); }
+
+// ピークが徐々に大きくなる入力でも、出力×masterVolume が上限を超えない
+void test_limiter_ceiling(void)
+{
+  static Limiter testLimiter;
+  masterVolume = 0.5f;
+  const float ceiling = LIMITER_CEILING * 32767.0f / masterVolume;
+  srand(2);
+  float data[SAMPLE_BUFFER_SIZE * OUTPUT_CHANNELS];
+  uint32_t index = 0;
+  for (uint32_t block = 0; block < 4000; block++)
+  {
+    for (uint32_t n = 0; n < SAMPLE_BUFFER_SIZE; n++, index++)
+    {
+      // 少しずつ大きくなるピークと、ランダムな突発音
+      float level = (index % 5000) * 40.0f;
+      if (rand() % 500 == 0) level = 200000.0f * rand() / RAND_MAX;
+      data[n * 2] = (n & 1 ? level : -level) * rand() / RAND_MAX;
+      data[n * 2 + 1] = level * rand() / RAND_MAX;
+    }
+    testLimiter.Process(data);
+    for (uint32_t i = 0; i < SAMPLE_BUFFER_SIZE * OUTPUT_CHANNELS; i++)
+      TEST_ASSERT_LESS_OR_EQUAL_FLOAT(ceiling * 1.0001f, fabsf(data[i]));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_sliding_minimum_random);
+  RUN_TEST(test_sliding_minimum_rising);
+  RUN_TEST(test_sliding_minimum_falling);
+  RUN_TEST(test_sliding_minimum_repeated_values);
+  RUN_TEST(test_limiter_ceiling);
+  return UNITY_END();
+}
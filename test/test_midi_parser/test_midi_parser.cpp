@@ -0,0 +1,154 @@
+// MidiParser のホスト用テスト pio test -e native
+// 記録したMIDIのバイト列を流し、onMessage・onSysEx に渡されたものを比べる
+#include <unity.h>
+#include <vector>
+
+#include "MidiParser.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+static MidiParser parser;
+static std::vector<Bytes> messages;
+static std::vector<Bytes> sysExes;
+
+void setUp(void)
+{
+  parser = MidiParser();
+  parser.onMessage = [](const uint8_t *message, uint8_t size) { messages.push_back(Bytes(message, message + size)); };
+  parser.onSysEx = [](const uint8_t *data, size_t size) { sysExes.push_back(Bytes(data, data + size)); };
+  messages.clear();
+  sysExes.clear();
+}
+
+void tearDown(void) {}
+
+static void Feed(const Bytes &stream) { parser.Parse(stream.data(), stream.size()); }
+
+static void CheckMessages(const std::vector<Bytes> &expected)
+{
+  TEST_ASSERT_EQUAL_size_t(expected.size(), messages.size());
+  for (size_t i = 0; i < expected.size(); i++)
+  {
+    TEST_ASSERT_EQUAL_size_t(expected[i].size(), messages[i].size());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected[i].data(), messages[i].data(), expected[i].size());
+  }
+}
+
+// キーボードからの記録 ノートオフはベロシティ0のノートオンで、ステータスは省略されている
+void test_running_status(void)
+{
+  Feed({0x90, 0x3C, 0x40, 0x40, 0x48, 0x3C, 0x00, 0x40, 0x00, 0xB0, 0x40, 0x7F, 0x40, 0x00, 0xC1, 0x05, 0x06});
+  CheckMessages({
+      {0x90, 0x3C, 0x40},
+      {0x90, 0x40, 0x48},
+      {0x90, 0x3C, 0x00},
+      {0x90, 0x40, 0x00},
+      {0xB0, 0x40, 0x7F},
+      {0xB0, 0x40, 0x00},
+      {0xC1, 0x05},
+      {0xC1, 0x06},
+  });
+}
+
+// 値が0のデータバイトもメッセージの区切りにならない
+void test_zero_data_bytes(void)
+{
+  Feed({0x80, 0x00, 0x00, 0xE0, 0x00, 0x00, 0xC0, 0x00, 0xD0, 0x00, 0xB0, 0x00, 0x00, 0x00, 0x00});
+  CheckMessages({
+      {0x80, 0x00, 0x00},
+      {0xE0, 0x00, 0x00},
+      {0xC0, 0x00},
+      {0xD0, 0x00},
+      {0xB0, 0x00, 0x00},
+      {0xB0, 0x00, 0x00},
+  });
+}
+
+// メッセージの途中に割り込んだクロック・アクティブセンシングは、その場で単独で渡す
+void test_realtime_inside_message(void)
+{
+  Feed({0x90, 0xF8, 0x3C, 0xFE, 0x40, 0x3E, 0xF8, 0x40, 0xE0, 0x00, 0xFA, 0x40});
+  CheckMessages({
+      {0xF8},
+      {0xFE},
+      {0x90, 0x3C, 0x40},
+      {0xF8},
+      {0x90, 0x3E, 0x40},
+      {0xFA},
+      {0xE0, 0x00, 0x40},
+  });
+}
+
+// SysExの途中のリアルタイムメッセージはSysExに含めない
+void test_realtime_inside_sysex(void)
+{
+  Feed({0xF0, 0x7E, 0xF8, 0x7F, 0x09, 0xFE, 0x01, 0xF7, 0x90, 0x3C, 0x40});
+  CheckMessages({{0xF8}, {0xFE}, {0x90, 0x3C, 0x40}});
+  TEST_ASSERT_EQUAL_size_t(1, sysExes.size());
+  Bytes expected = {0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7};
+  TEST_ASSERT_EQUAL_size_t(expected.size(), sysExes[0].size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected.data(), sysExes[0].data(), expected.size());
+}
+
+// MIDI_SYSEX_SIZE を超えたSysExは切り詰め、後に続くメッセージは通常通り解析する
+void test_sysex_overflow(void)
+{
+  Bytes stream = {0xF0};
+  for (int i = 0; i < MIDI_SYSEX_SIZE * 2; i++) stream.push_back(i & 0x7F);
+  stream.push_back(0xF7);
+  stream.insert(stream.end(), {0x90, 0x3C, 0x40});
+  Feed(stream);
+
+  TEST_ASSERT_EQUAL_size_t(1, sysExes.size());
+  TEST_ASSERT_EQUAL_size_t(MIDI_SYSEX_SIZE, sysExes[0].size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(stream.data(), sysExes[0].data(), MIDI_SYSEX_SIZE);
+  TEST_ASSERT_EQUAL_UINT32(1, parser.SysExOverflows());
+  CheckMessages({{0x90, 0x3C, 0x40}});
+
+  // 収まるものは数えない
+  Feed({0xF0, 0x01, 0x02, 0xF7});
+  TEST_ASSERT_EQUAL_UINT32(1, parser.SysExOverflows());
+}
+
+// F7の代わりに次のステータスでSysExが終わる
+void test_sysex_ended_by_status(void)
+{
+  Feed({0xF0, 0x43, 0x10, 0x4C, 0x90, 0x3C, 0x40});
+  TEST_ASSERT_EQUAL_size_t(1, sysExes.size());
+  Bytes expected = {0xF0, 0x43, 0x10, 0x4C};
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected.data(), sysExes[0].data(), expected.size());
+  CheckMessages({{0x90, 0x3C, 0x40}});
+}
+
+// システムコモン・対応の無いF7の後は、ステータスを受け取るまでデータバイトを捨てる
+void test_system_common_clears_running_status(void)
+{
+  Feed({0x90, 0x3C, 0x40, 0xF3, 0x01, 0x3E, 0x40, 0x90, 0x3E, 0x40, 0xF7, 0x3F, 0x40, 0xF6, 0x41, 0x40});
+  CheckMessages({
+      {0x90, 0x3C, 0x40},
+      {0xF3, 0x01},
+      {0x90, 0x3E, 0x40},
+      {0xF6},
+  });
+}
+
+// 途中から受信し始めた場合、最初のステータスまでのデータバイトは捨てる
+void test_data_before_status(void)
+{
+  Feed({0x40, 0x00, 0x7F, 0xB0, 0x07, 0x64});
+  CheckMessages({{0xB0, 0x07, 0x64}});
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_running_status);
+  RUN_TEST(test_zero_data_bytes);
+  RUN_TEST(test_realtime_inside_message);
+  RUN_TEST(test_realtime_inside_sysex);
+  RUN_TEST(test_sysex_overflow);
+  RUN_TEST(test_sysex_ended_by_status);
+  RUN_TEST(test_system_common_clears_running_status);
+  RUN_TEST(test_data_before_status);
+  return UNITY_END();
+}
@@ -0,0 +1,98 @@
+// ストリーミング再生のホスト用テスト pio test -e native
+#include <unity.h>
+
+#include "SampleStream.h"
+
+#define TEST_LENGTH (STREAM_CHUNK * 8 + 100)
+#define TEST_RESIDENT_LENGTH 1000
+
+static Sample sample;
+static SampleStream stream;
+
+// 波形の値はサンプル番号から決まるので、読み込んだ位置を確かめられる
+static int16_t Expected(int64_t index)
+{
+  return index >= 0 && index < TEST_LENGTH ? (int16_t)(index % 30000) : 0;
+}
+
+void setUp(void)
+{
+  stream.file = tmpfile();
+  stream.dataOffset = 0;
+  for (int i = 0; i < TEST_LENGTH; i++)
+  {
+    int16_t value = Expected(i);
+    fwrite(&value, sizeof(value), 1, stream.file);
+  }
+  sample.length = TEST_LENGTH;
+  sample.residentLength = TEST_RESIDENT_LENGTH;
+  sample.stream = &stream;
+}
+
+void tearDown(void)
+{
+  fclose(stream.file);
+}
+
+static void CheckChunk(const int16_t *data, uint32_t chunk)
+{
+  TEST_ASSERT_NOT_NULL(data);
+  int64_t first = (int64_t)StreamStart(&sample) + (int64_t)chunk * STREAM_CHUNK - STREAM_GUARD_BEFORE;
+  for (int i = 0; i < STREAM_GUARD_BEFORE + STREAM_CHUNK + STREAM_GUARD_AFTER; i++)
+    TEST_ASSERT_EQUAL(Expected(first + i), data[i]);
+}
+
+// 読み込みが間に合っていれば、チャンクを順に読める
+void test_sequential_chunks(void)
+{
+  StreamBuffer buffer;
+  buffer.Start(&sample);
+  for (uint32_t chunk = 0; chunk < 8; chunk++)
+  {
+    buffer.Fill();
+    CheckChunk(buffer.Acquire(chunk), chunk);
+  }
+}
+
+// 読み込みが止まっている間に再生位置が数チャンク進んでも、読み込みが再開すればその位置から鳴る
+void test_resume_after_underrun(void)
+{
+  StreamBuffer buffer;
+  buffer.Start(&sample);
+  buffer.Fill();
+  CheckChunk(buffer.Acquire(0), 0);
+
+  // 先読み済みのチャンク1の後、読み込みタスクが動かない間にチャンク2〜4を無音で通り過ぎる
+  CheckChunk(buffer.Acquire(1), 1);
+  for (uint32_t chunk = 2; chunk <= 4; chunk++) TEST_ASSERT_NULL(buffer.Acquire(chunk));
+
+  // 再開後は、最後に要求し直したチャンクとその次から続けて読める
+  buffer.Fill();
+  for (uint32_t chunk = 4; chunk < 8; chunk++)
+  {
+    CheckChunk(buffer.Acquire(chunk), chunk);
+    buffer.Fill();
+  }
+}
+
+// ノートオンし直したら前の音のチャンクは使わない
+void test_restart_discards_previous_note(void)
+{
+  StreamBuffer buffer;
+  buffer.Start(&sample);
+  buffer.Fill();
+  CheckChunk(buffer.Acquire(0), 0);
+  buffer.Start(&sample);
+  TEST_ASSERT_NULL(buffer.Acquire(0));
+  buffer.Fill();
+  CheckChunk(buffer.Acquire(0), 0);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_sequential_chunks);
+  RUN_TEST(test_resume_after_underrun);
+  RUN_TEST(test_restart_discards_previous_note);
+  return UNITY_END();
+}
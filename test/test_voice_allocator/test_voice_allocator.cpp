@@ -0,0 +1,74 @@
+// VoiceAllocator のホスト用テスト pio test -e native
+#include <unity.h>
+
+#include "Sampler.h"
+#include "Instrument.h"
+#include "VoiceAllocator.h"
+
+extern const int16_t piano_sample[128000];
+
+// ループもADSRも無く、最初から音量通りに鳴るSample
+static Sample oneShot = {piano_sample, 128000, 60, 0, 0, false, 0.0f, 0.0f, 0.0f, 0.0f, InterpolationLinear};
+static const SampleZone oneShotZones[] = {{&oneShot, 0, 127, 0, 127}};
+static Instrument oneShotInstrument = {oneShotZones, 1};
+
+static void RenderBlocks(int count)
+{
+  float data[SAMPLE_BUFFER_SIZE * OUTPUT_CHANNELS];
+  for (int i = 0; i < count; i++) RenderBlock(data);
+}
+
+static uint8_t FindVoice(uint8_t channel, uint8_t noteNo)
+{
+  for (uint8_t i = 0; i < MAX_SOUND; i++)
+    if (voiceAllocator.ChannelVoices(channel).Has(i) && players[i].noteNo == noteNo) return i;
+  return VOICE_NONE;
+}
+
+void setUp(void)
+{
+  // 前のテストのボイスをオールサウンドオフで止めてから始める
+  for (uint8_t channel = 0; channel < MIDI_CHANNELS; channel++) SendControlChange(120, 0, channel);
+  InitSampler();
+  InitInstrument(&oneShotInstrument);
+  SetInstrument(1, &oneShotInstrument);
+  voiceAllocator.policy = StealQuietest;
+}
+
+void tearDown(void) {}
+
+// ADSRの無い大きな音は、ADSRのある小さな音より後に止める
+void test_quietest_mixes_adsr_and_one_shot(void)
+{
+  SendNoteOn(40, 127, 1);
+  for (uint8_t i = 1; i < MAX_SOUND; i++) SendNoteOn(50 + i, 20, 0);
+  RenderBlocks(20);
+  uint8_t loud = FindVoice(1, 40);
+  TEST_ASSERT_TRUE(loud != VOICE_NONE);
+
+  SendNoteOn(100, 100, 0);
+  TEST_ASSERT_TRUE(FindVoice(1, 40) == loud);
+  TEST_ASSERT_EQUAL(MAX_SOUND - 1, voiceAllocator.ChannelCount(0));
+}
+
+// チャンネルの音量(CC7)で小さくなっているボイスから止める
+void test_quietest_uses_channel_volume(void)
+{
+  SendControlChange(7, 10, 2);
+  SendNoteOn(40, 127, 2);
+  for (uint8_t i = 1; i < MAX_SOUND; i++) SendNoteOn(50 + i, 60, 0);
+  RenderBlocks(20);
+  TEST_ASSERT_TRUE(FindVoice(2, 40) != VOICE_NONE);
+
+  SendNoteOn(100, 100, 0);
+  TEST_ASSERT_TRUE(FindVoice(2, 40) == VOICE_NONE);
+  TEST_ASSERT_EQUAL(MAX_SOUND, voiceAllocator.ChannelCount(0));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_quietest_mixes_adsr_and_one_shot);
+  RUN_TEST(test_quietest_uses_channel_volume);
+  return UNITY_END();
+}
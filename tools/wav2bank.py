@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+"""WAVファイルからサンプルバンク(include/SampleBank.h の形式)を作る
+
+usage: wav2bank.py -o piano.bank piano_c4.wav,root=60,notes=0-127 ...
+
+各引数は WAVファイルのパスの後に、カンマ区切りで以下の設定を続ける
+  root=60            ルートのノート番号 (省略時は smpl チャンク、無ければ60)
+  notes=0-127        鍵域
+  velocities=0-127   ベロシティの範囲
+  loop=24120-24288   ループ区間 [開始, 終了) (省略時は smpl チャンクの最初のループ)
+  adsr=1             ADSRとループを有効にする (省略時はループがあれば有効)
+  attack=1 decay=1300 sustain=0.1 release=130   ADSR (ms, 0〜1)
+  interp=hermite     none | linear | hermite | sinc
+  encoding=pcm       pcm | adpcm (IMA-ADPCM、約1/4の大きさ)
+WAVは16/24/32bit整数または32bit浮動小数点で、複数チャンネルはモノラルに混ぜる
+"""
+
+import argparse
+import array
+import struct
+import sys
+
+MAGIC = b"SBNK"
+VERSION = 1
+ALIGN = 4
+MAX_SAMPLES = 32
+MAX_ZONES = 64
+VELOCITY_LAYERS = 16  # ZONE_VELOCITY_LAYERS (include/Instrument.h)
+SAMPLE_RATE = 44100
+INTERPOLATIONS = ["none", "linear", "hermite", "sinc"]
+ENCODINGS = ["pcm", "adpcm"]
+ADPCM_BLOCK_SAMPLES = 128
+
+STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767]
+INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+HEADER = struct.Struct("<4sHHHHI")
+SAMPLE = struct.Struct("<IIIIBBBBffff")
+ZONE = struct.Struct("<BBBBB3x")
+
+
+def read_wav(path):
+    """モノラルのint16配列と、smpl チャンクの (ルート, ループ開始, ループ終了) を返す"""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[0:4] != b"RIFF" or data[8:12] != b"WAVE":
+        raise ValueError(f"{path}: not a WAV file")
+    fmt = None
+    pcm = None
+    smpl = (None, None, None)
+    pos = 12
+    while pos + 8 <= len(data):
+        chunk_id, chunk_size = struct.unpack_from("<4sI", data, pos)
+        body = data[pos + 8:pos + 8 + chunk_size]
+        if chunk_id == b"fmt ":
+            fmt = struct.unpack_from("<HHIIHH", body)
+            if fmt[0] == 0xFFFE:  # WAVE_FORMAT_EXTENSIBLE はサブフォーマットを見る
+                fmt = (struct.unpack_from("<H", body, 24)[0],) + fmt[1:]
+        elif chunk_id == b"data":
+            pcm = body
+        elif chunk_id == b"smpl" and len(body) >= 36:
+            root = struct.unpack_from("<I", body, 12)[0]
+            loops = struct.unpack_from("<I", body, 28)[0]
+            if loops > 0 and len(body) >= 60:
+                start, end = struct.unpack_from("<II", body, 36 + 8)
+                smpl = (root, start, end + 1)  # smpl の終端は最後のサンプルを含む
+            else:
+                smpl = (root, None, None)
+        pos += 8 + chunk_size + (chunk_size & 1)
+    if fmt is None or pcm is None:
+        raise ValueError(f"{path}: missing fmt or data chunk")
+
+    format_tag, channels, rate, _, _, bits = fmt
+    if rate != SAMPLE_RATE:
+        print(f"warning: {path}: {rate} Hz is played back at {SAMPLE_RATE} Hz", file=sys.stderr)
+    width = bits // 8
+    frames = len(pcm) // (width * channels)
+    values = []
+    for i in range(frames * channels):
+        raw = pcm[i * width:(i + 1) * width]
+        if format_tag == 3 and bits == 32:
+            value = struct.unpack("<f", raw)[0]
+        elif format_tag == 1 and bits in (16, 24, 32):
+            value = int.from_bytes(raw, "little", signed=True) / float(1 << (bits - 1))
+        else:
+            raise ValueError(f"{path}: unsupported format {format_tag}/{bits}bit")
+        values.append(value)
+
+    mono = array.array("h")
+    for i in range(frames):
+        value = sum(values[i * channels:(i + 1) * channels]) / channels
+        mono.append(max(-32768, min(32767, int(round(value * 32768)))))
+    return mono, smpl
+
+
+def encode_adpcm(pcm, loop_start, loop_end):
+    """src/Adpcm.cpp と同じブロック構成でIMA-ADPCMに圧縮する"""
+    out = bytearray()
+    index = 0
+    for segment_start, segment_end in ((0, loop_start), (loop_start, loop_end), (loop_end, len(pcm))):
+        for start in range(segment_start, segment_end, ADPCM_BLOCK_SAMPLES):
+            end = min(start + ADPCM_BLOCK_SAMPLES, segment_end)
+            # ブロック単位で展開するので、予測値は直前の元のサンプルから始める
+            predictor = pcm[start - 1] if start > 0 else 0
+            out += struct.pack("<hBx", predictor, index)
+            nibbles = bytearray(ADPCM_BLOCK_SAMPLES // 2)
+            for i in range(end - start):
+                step = STEP_TABLE[index]
+                diff = pcm[start + i] - predictor
+                code = 8 if diff < 0 else 0
+                diff = abs(diff)
+                quantized = step >> 3
+                if diff >= step:
+                    code |= 4
+                    diff -= step
+                    quantized += step
+                if diff >= step >> 1:
+                    code |= 2
+                    diff -= step >> 1
+                    quantized += step >> 1
+                if diff >= step >> 2:
+                    code |= 1
+                    quantized += step >> 2
+                predictor += -quantized if code & 8 else quantized
+                predictor = max(-32768, min(32767, predictor))
+                index = max(0, min(88, index + INDEX_TABLE[code & 7]))
+                nibbles[i >> 1] |= code << ((i & 1) * 4)
+            out += nibbles
+    return bytes(out)
+
+
+def parse_range(text):
+    low, high = text.split("-")
+    return int(low), int(high)
+
+
+def parse_zone(spec):
+    path, *options = spec.split(",")
+    settings = dict(option.split("=", 1) for option in options)
+    pcm, (smpl_root, smpl_start, smpl_end) = read_wav(path)
+
+    root = int(settings.get("root", smpl_root if smpl_root is not None else 60))
+    if "loop" in settings:
+        loop_start, loop_end = parse_range(settings["loop"])
+    elif smpl_start is not None:
+        loop_start, loop_end = smpl_start, smpl_end
+    else:
+        loop_start, loop_end = 0, 0
+    adsr = int(settings.get("adsr", 1 if loop_end > loop_start else 0))
+    if adsr and not loop_start < loop_end <= len(pcm):
+        raise ValueError(f"{path}: ADSR needs a loop inside the sample")
+    sample = (
+        path,
+        root,
+        loop_start,
+        loop_end,
+        adsr,
+        INTERPOLATIONS.index(settings.get("interp", "hermite")),
+        float(settings.get("attack", 1.0)),
+        float(settings.get("decay", 1300.0)),
+        float(settings.get("sustain", 0.1)),
+        float(settings.get("release", 130.0)),
+        ENCODINGS.index(settings.get("encoding", "pcm")),
+    )
+    notes = parse_range(settings.get("notes", "0-127"))
+    velocities = parse_range(settings.get("velocities", "0-127"))
+    return sample, pcm, notes, velocities
+
+
+def count_velocity_layers(zones):
+    """InitInstrument と同じく、どの鍵でも同じゾーンを選ぶ連続したベロシティの範囲を数える"""
+    def distance(value, low, high):
+        return low - value if value < low else value - high if value > high else 0
+
+    layers = 0
+    previous = None
+    for velocity in range(128):
+        column = []
+        for note in range(128):
+            distances = [distance(note, z[1], z[2]) * 128 + distance(velocity, z[3], z[4]) for z in zones]
+            column.append(distances.index(min(distances)))
+        if column != previous:
+            layers += 1
+            previous = column
+    return layers
+
+
+def main():
+    parser = argparse.ArgumentParser(description="convert WAV files to a sample bank")
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("zones", nargs="+", help="file.wav[,key=value...]")
+    args = parser.parse_args()
+
+    samples = []  # 同じ設定のWAVは1つのSampleにまとめる
+    pcms = []
+    zones = []
+    for spec in args.zones:
+        sample, pcm, notes, velocities = parse_zone(spec)
+        if sample not in samples:
+            samples.append(sample)
+            pcms.append(pcm)
+        zones.append((samples.index(sample),) + notes + velocities)
+    if len(samples) > MAX_SAMPLES or len(zones) > MAX_ZONES:
+        sys.exit(f"too many samples or zones (max {MAX_SAMPLES}/{MAX_ZONES})")
+    layers = count_velocity_layers(zones)
+    if layers > VELOCITY_LAYERS:
+        sys.exit(f"too many velocity layers: {layers} (max {VELOCITY_LAYERS})")
+
+    offset = HEADER.size + SAMPLE.size * len(samples) + ZONE.size * len(zones)
+    entries = []
+    payload = bytearray()
+    for sample, pcm in zip(samples, pcms):
+        padding = -(offset + len(payload)) % ALIGN
+        payload += b"\0" * padding
+        _, root, loop_start, loop_end, adsr, interp, attack, decay, sustain, release, encoding = sample
+        entries.append(SAMPLE.pack(offset + len(payload), len(pcm), loop_start, loop_end,
+                                   root, adsr, interp, encoding, attack, decay, sustain, release))
+        if encoding == ENCODINGS.index("adpcm"):
+            payload += encode_adpcm(pcm, loop_start, loop_end)
+        else:
+            if sys.byteorder != "little":
+                pcm.byteswap()
+            payload += pcm.tobytes()
+
+    size = offset + len(payload)
+    with open(args.output, "wb") as f:
+        f.write(HEADER.pack(MAGIC, VERSION, len(samples), len(zones), 0, size))
+        for entry in entries:
+            f.write(entry)
+        for zone in zones:
+            f.write(ZONE.pack(*zone))
+        f.write(payload)
+    print(f"{args.output}: {len(samples)} samples, {len(zones)} zones, {size} bytes")
+
+
+if __name__ == "__main__":
+    main()